@@ -0,0 +1,28 @@
+#include "alloc_counter.h"
+#include <stdlib.h>
+#include <new>
+
+thread_local unsigned long alloc_counter::t_count = 0;
+std::atomic<unsigned long long> alloc_counter::s_requests(0);
+std::atomic<unsigned long long> alloc_counter::s_allocs(0);
+std::atomic<unsigned long long> alloc_counter::s_alloc_requests(0);
+
+//全局operator new：计数后交给malloc；数组形式和nothrow形式默认转调这里
+void *operator new(size_t size)
+{
+    alloc_counter::add();
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    free(p);
+}
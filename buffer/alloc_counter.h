@@ -0,0 +1,57 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <atomic>
+
+/*************************************************************
+* 堆分配计数：替换全局operator new，每个线程累计自己的分配次数，不加锁
+* 缓冲区池和请求内存池向系统申请内存时也调用add计入
+* 处理请求前后各取一次当前线程的计数，差值即该请求的堆分配次数，由record_request汇总
+* 稳定状态下（文件缓存和各内存池已预热）每个请求的分配次数应为0
+**************************************************************/
+
+class alloc_counter
+{
+public:
+    //当前线程累计的堆分配次数
+    static unsigned long thread_count()
+    {
+        return t_count;
+    }
+    //计入一次不经过operator new的堆分配
+    static void add()
+    {
+        ++t_count;
+    }
+    //汇总一个请求处理期间的分配次数
+    static void record_request(unsigned long allocs)
+    {
+        s_requests.fetch_add(1, std::memory_order_relaxed);
+        if (allocs)
+        {
+            s_allocs.fetch_add(allocs, std::memory_order_relaxed);
+            s_alloc_requests.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    //已处理的请求数、这些请求的分配总次数、有分配的请求数
+    static unsigned long long requests()
+    {
+        return s_requests.load(std::memory_order_relaxed);
+    }
+    static unsigned long long allocs()
+    {
+        return s_allocs.load(std::memory_order_relaxed);
+    }
+    static unsigned long long alloc_requests()
+    {
+        return s_alloc_requests.load(std::memory_order_relaxed);
+    }
+
+private:
+    static thread_local unsigned long t_count;
+    static std::atomic<unsigned long long> s_requests;
+    static std::atomic<unsigned long long> s_allocs;
+    static std::atomic<unsigned long long> s_alloc_requests;
+};
+
+#endif
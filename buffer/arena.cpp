@@ -0,0 +1,91 @@
+#include "arena.h"
+#include "alloc_counter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+arena *arena::local()
+{
+    static thread_local arena instance;
+    return &instance;
+}
+
+arena::~arena()
+{
+    while (m_head)
+    {
+        block *next = m_head->next;
+        free(m_head);
+        m_head = next;
+    }
+}
+
+void *arena::alloc(size_t size)
+{
+    //按指针大小对齐
+    size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    if (!m_current || m_offset + size > m_current->size)
+    {
+        //之前请求留下的后继块足够大时直接复用
+        block *next = m_current ? m_current->next : m_head;
+        if (!next || next->size < size)
+            next = grow(size);
+        m_current = next;
+        m_offset = 0;
+    }
+    void *p = m_current->data() + m_offset;
+    m_offset += size;
+    m_used += size;
+    return p;
+}
+
+char *arena::copy(const char *str, size_t len)
+{
+    char *p = (char *)alloc(len + 1);
+    memcpy(p, str, len);
+    p[len] = '\0';
+    return p;
+}
+
+arena::block *arena::grow(size_t size)
+{
+    size_t data_size = size > MIN_BLOCK ? size : MIN_BLOCK;
+    block *b = (block *)malloc(sizeof(block) + data_size);
+    if (!b)
+        throw std::bad_alloc();
+    alloc_counter::add();
+    b->size = data_size;
+    if (m_current)
+    {
+        b->next = m_current->next;
+        m_current->next = b;
+    }
+    else
+    {
+        b->next = m_head;
+        m_head = b;
+    }
+    return b;
+}
+
+void arena::reset()
+{
+    //保留开头的块，超出MAX_RETAIN的部分释放
+    size_t kept = 0;
+    block **link = &m_head;
+    while (*link)
+    {
+        block *b = *link;
+        if (kept + b->size <= MAX_RETAIN || b == m_head)
+        {
+            kept += b->size;
+            link = &b->next;
+            continue;
+        }
+        *link = b->next;
+        free(b);
+    }
+    m_current = NULL;
+    m_offset = 0;
+    m_used = 0;
+}
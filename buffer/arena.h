@@ -0,0 +1,60 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*************************************************************
+* 请求内存池（bump arena）：处理请求期间的临时内存从当前块中顺序切分，不逐个释放
+* 每个线程一个，请求处理完毕（响应报文已生成）后整体重置，块保留给下一个请求复用
+* 一个请求只在一个线程中完成解析和生成响应，各线程互不共享，分配时无需加锁
+* 超过MAX_RETAIN的块在重置时释放，偶尔的大请求不会一直占用内存
+**************************************************************/
+
+class arena
+{
+public:
+    //当前线程的arena
+    static arena *local();
+
+    //分配size字节，按指针大小对齐；内容在reset之前有效
+    void *alloc(size_t size);
+    //复制len个字符并以'\0'结尾
+    char *copy(const char *str, size_t len);
+    //丢弃本次请求分配的全部内存
+    void reset();
+    //本次请求已分配的字节数
+    size_t used() const
+    {
+        return m_used;
+    }
+
+public:
+    static const size_t MIN_BLOCK = 4096;       //默认块大小
+    static const size_t MAX_RETAIN = 65536;     //重置后保留的块总大小上限
+
+private:
+    arena() : m_head(NULL), m_current(NULL), m_offset(0), m_used(0) {}
+    ~arena();
+    arena(const arena &);
+    arena &operator=(const arena &);
+
+    struct block
+    {
+        block *next;
+        size_t size;                            //数据区大小，数据区紧跟在块头之后
+        char *data()
+        {
+            return (char *)(this + 1);
+        }
+    };
+    //在当前块之后接入一个不小于size的块
+    block *grow(size_t size);
+
+private:
+    block *m_head;
+    block *m_current;
+    size_t m_offset;                            //当前块中已分配的字节数
+    size_t m_used;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "buffer_pool.h"
+#include "alloc_counter.h"
+
+buffer_pool::~buffer_pool()
+{
+    for (int i = 0; i < CLASS_NUM; ++i)
+    {
+        for (size_t j = 0; j < m_classes[i].free_list.size(); ++j)
+            free(m_classes[i].free_list[j]);
+    }
+}
+
+int buffer_pool::class_of(int size)
+{
+    int idx = 0;
+    int cap = MIN_SIZE;
+    while (cap < size)
+    {
+        cap <<= 1;
+        ++idx;
+    }
+    return idx;
+}
+
+char *buffer_pool::alloc(int size, int &capacity)
+{
+    if (size > MAX_SIZE)
+        return NULL;
+    int idx = class_of(size);
+    capacity = MIN_SIZE << idx;
+    m_in_use++;
+
+    size_class &sc = m_classes[idx];
+    sc.lock.lock();
+    if (!sc.free_list.empty())
+    {
+        char *buf = sc.free_list.back();
+        sc.free_list.pop_back();
+        sc.lock.unlock();
+        return buf;
+    }
+    sc.lock.unlock();
+
+    //该级别没有空闲缓冲区，向系统申请
+    alloc_counter::add();
+    char *buf = (char *)malloc(capacity);
+    if (!buf)
+        m_in_use--;
+    return buf;
+}
+
+void buffer_pool::release(char *buf, int capacity)
+{
+    if (!buf)
+        return;
+    m_in_use--;
+    size_class &sc = m_classes[class_of(capacity)];
+    sc.lock.lock();
+    if ((int)(sc.free_list.size() + 1) * capacity <= CACHE_BYTES)
+    {
+        sc.free_list.push_back(buf);
+        buf = NULL;
+    }
+    sc.lock.unlock();
+    free(buf);
+}
@@ -0,0 +1,55 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <vector>
+#include <atomic>
+#include <stdlib.h>
+#include "../lock/locker.h"
+
+/*************************************************************
+* 缓冲区池：按大小分级（1KB、2KB、4KB...64KB）缓存空闲缓冲区
+* 连接只在处理请求期间借用读写缓冲区，请求头或请求体较大时换用更大一级的缓冲区，
+* 长连接进入空闲状态或连接关闭后立即归还，大量空闲长连接不再各自占用固定大小的缓冲区
+* 单例模式：所有Reactor线程和工作线程共享，每个级别独立加锁
+**************************************************************/
+
+class buffer_pool
+{
+public:
+    static buffer_pool *get_instance()
+    {
+        static buffer_pool instance;
+        return &instance;
+    }
+
+    //借用一个不小于size的缓冲区，capacity返回缓冲区实际大小；size超过最大级别时返回NULL
+    char *alloc(int size, int &capacity);
+    //归还缓冲区，capacity必须是alloc返回的大小
+    void release(char *buf, int capacity);
+    //已借出、尚未归还的缓冲区个数，连接关闭后其缓冲区应当全部归还
+    int in_use() const { return m_in_use; }
+
+public:
+    static const int MIN_SIZE = 1024;       //最小级别
+    static const int MAX_SIZE = 65536;      //最大级别
+    static const int CLASS_NUM = 7;         //级别个数
+    static const int CACHE_BYTES = 4 << 20; //每个级别最多缓存的空闲字节数，超出部分直接释放
+
+private:
+    buffer_pool() : m_in_use(0) {}
+    ~buffer_pool();
+
+    //size对应的级别下标
+    static int class_of(int size);
+
+private:
+    struct size_class
+    {
+        locker lock;
+        std::vector<char *> free_list;
+    };
+    size_class m_classes[CLASS_NUM];
+    std::atomic<int> m_in_use;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "compressor.h"
+#include "file_cache.h"
+#include <string.h>
+#include <zlib.h>
+#include <brotli/encode.h>
+
+compressor::compressor()
+{
+    //压缩线程随单例一起创建，整个进程生命周期内运行
+    if (pthread_create(&m_thread, NULL, worker, NULL) == 0)
+        pthread_detach(m_thread);
+}
+
+bool compressor::submit(file_entry *entry)
+{
+    m_lock.lock();
+    if ((int)m_queue.size() >= MAX_QUEUE)
+    {
+        m_lock.unlock();
+        return false;
+    }
+    m_queue.push_back(entry);
+    m_lock.unlock();
+    m_queuestat.post();
+    return true;
+}
+
+void compressor::run()
+{
+    while (true)
+    {
+        m_queuestat.wait();
+        m_lock.lock();
+        if (m_queue.empty())
+        {
+            m_lock.unlock();
+            continue;
+        }
+        file_entry *entry = m_queue.front();
+        m_queue.pop_front();
+        m_lock.unlock();
+
+        //压缩后没有明显变小的副本不保留，之后的请求直接使用原始内容
+        std::string encoded[ENCODING_NUM];
+        size_t len = entry->st.st_size;
+        if (!gzip(entry->addr, len, encoded[ENCODING_GZIP]) || encoded[ENCODING_GZIP].size() > len * 9 / 10)
+            encoded[ENCODING_GZIP].clear();
+        if (!brotli(entry->addr, len, encoded[ENCODING_BR]) || encoded[ENCODING_BR].size() > len * 9 / 10)
+            encoded[ENCODING_BR].clear();
+
+        file_cache::get_instance()->set_encoded(entry, encoded);
+        file_cache::get_instance()->release(entry);
+    }
+}
+
+bool compressor::gzip(const char *data, size_t len, std::string &out)
+{
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    //windowBits加16生成带gzip头部和尾部的格式
+    if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+    out.resize(deflateBound(&zs, len));
+    zs.next_in = (Bytef *)data;
+    zs.avail_in = len;
+    zs.next_out = (Bytef *)&out[0];
+    zs.avail_out = out.size();
+    int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return ret == Z_STREAM_END;
+}
+
+bool compressor::brotli(const char *data, size_t len, std::string &out)
+{
+    size_t size = BrotliEncoderMaxCompressedSize(len);
+    if (0 == size)
+        return false;
+    out.resize(size);
+    int quality = len > BR_LARGE_INPUT ? BR_LARGE_QUALITY : BR_QUALITY;
+    if (!BrotliEncoderCompress(quality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len, (const uint8_t *)data,
+                               &size, (uint8_t *)&out[0]))
+        return false;
+    out.resize(size);
+    return true;
+}
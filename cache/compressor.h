@@ -0,0 +1,60 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+
+#include <list>
+#include <string>
+#include <pthread.h>
+#include "../lock/locker.h"
+
+struct file_entry;
+
+/*************************************************************
+* 后台压缩线程：为文件缓存中可压缩的文件生成gzip和br副本，保存在缓存条目中
+* 请求路径上从不压缩：副本未生成时先返回原始内容，同时把条目交给本线程，之后的请求直接使用副本
+* 队列中的条目各持有一个引用，压缩完成后释放；队列已满时不再排队，之后的请求会重新提交
+* 单例模式：所有Reactor线程和工作线程共享一个压缩线程
+**************************************************************/
+
+class compressor
+{
+public:
+    static compressor *get_instance()
+    {
+        static compressor instance;
+        return &instance;
+    }
+    //子线程执行压缩任务的回调函数
+    static void *worker(void *)
+    {
+        compressor::get_instance()->run();
+        return NULL;
+    }
+
+    //提交压缩任务，entry须已由调用方增加引用，返回false表示队列已满，由调用方释放引用
+    bool submit(file_entry *entry);
+
+public:
+    static const int MAX_QUEUE = 256;   //等待压缩的条目数上限
+    static const int GZIP_LEVEL = 9;    //不在请求路径上，使用最高压缩级别
+    static const int BR_QUALITY = 11;
+    //质量11的brotli每MB需要数秒，较大的文件改用较低的质量，避免唯一的压缩线程长时间被占用
+    static const size_t BR_LARGE_INPUT = 256 * 1024;
+    static const int BR_LARGE_QUALITY = 5;
+
+private:
+    compressor();
+    ~compressor() {}
+
+    void run();
+    //压缩失败返回false
+    static bool gzip(const char *data, size_t len, std::string &out);
+    static bool brotli(const char *data, size_t len, std::string &out);
+
+private:
+    locker m_lock;
+    sem m_queuestat;                    //是否有任务需要处理
+    std::list<file_entry *> m_queue;
+    pthread_t m_thread;
+};
+
+#endif
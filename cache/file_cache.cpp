@@ -0,0 +1,277 @@
+#include "file_cache.h"
+#include "compressor.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <vector>
+
+//每个请求都要读取一次时间，使用开销更小的粗粒度时钟，精度对TTL足够
+static long long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//只有由文件系统中的文件本身决定的结果可以缓存，描述符耗尽、内存不足等暂时性的失败下次请求重试
+static bool cacheable(const file_entry *entry)
+{
+    return 0 == entry->err || ENOENT == entry->err || EACCES == entry->err || EISDIR == entry->err;
+}
+
+file_cache::file_cache() : m_hits(0), m_misses(0)
+{
+    m_bytes = 0;
+    m_max_entries = MAX_ENTRIES;
+}
+
+file_cache::~file_cache()
+{
+    for (std::unordered_map<std::string, file_entry *>::iterator it = m_map.begin(); it != m_map.end(); ++it)
+        destroy(it->second);
+}
+
+file_entry *file_cache::load(const char *path, bool map)
+{
+    file_entry *entry = new file_entry;
+    entry->path = path;
+    entry->fd = -1;
+    entry->err = 0;
+    entry->addr = NULL;
+    entry->refs = 0;
+    entry->cached = false;
+    entry->checked = now_ms();
+    entry->encode_state = ENCODE_NONE;
+
+    //判断顺序与do_request原有的一致
+    if (stat(path, &entry->st) < 0)
+    {
+        entry->err = (ENOENT == errno || ENOTDIR == errno) ? ENOENT : errno;
+        memset(&entry->st, 0, sizeof(entry->st));
+        return entry;
+    }
+    if (!(entry->st.st_mode & S_IROTH))
+    {
+        entry->err = EACCES;
+        return entry;
+    }
+    if (!S_ISREG(entry->st.st_mode))
+    {
+        entry->err = S_ISDIR(entry->st.st_mode) ? EISDIR : EACCES;
+        return entry;
+    }
+
+    entry->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (entry->fd == -1)
+    {
+        entry->err = errno;
+        return entry;
+    }
+    //以打开的文件为准，避免stat和open之间文件被替换
+    fstat(entry->fd, &entry->st);
+    //超过MAX_FILE的文件不进入缓存，只由本次请求使用，调用方不需要映射时省去mmap
+    if (entry->st.st_size > 0 && (map || entry->st.st_size <= MAX_FILE))
+    {
+        void *addr = mmap(0, entry->st.st_size, PROT_READ, MAP_PRIVATE, entry->fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            entry->err = errno;
+            close(entry->fd);
+            entry->fd = -1;
+            return entry;
+        }
+        entry->addr = (char *)addr;
+        //不缓存的大文件通常只被顺序读取一遍，提示内核加大预读
+        if (entry->st.st_size > MAX_FILE)
+            madvise(addr, entry->st.st_size, MADV_SEQUENTIAL);
+    }
+    return entry;
+}
+
+bool file_cache::fresh(file_entry *entry)
+{
+    struct stat st;
+    if (stat(entry->path.c_str(), &st) < 0)
+        return entry->st.st_mode == 0;
+    return entry->st.st_mode == st.st_mode && entry->st.st_ino == st.st_ino &&
+           entry->st.st_dev == st.st_dev && entry->st.st_size == st.st_size &&
+           entry->st.st_mtim.tv_sec == st.st_mtim.tv_sec && entry->st.st_mtim.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+bool file_cache::remove(file_entry *entry)
+{
+    m_map.erase(entry->path);
+    m_lru.erase(entry->lru);
+    m_bytes -= entry->st.st_size + entry->response[0].size() + entry->response[1].size();
+    for (int i = 0; i < ENCODING_NUM; ++i)
+        m_bytes -= entry->encoded[i].size();
+    entry->cached = false;
+    return --entry->refs == 0;
+}
+
+void file_cache::destroy(file_entry *entry)
+{
+    if (entry->addr)
+        munmap(entry->addr, entry->st.st_size);
+    if (entry->fd != -1)
+        close(entry->fd);
+    delete entry;
+}
+
+int file_cache::acquire(const char *path, file_entry *&entry, bool map)
+{
+    std::vector<file_entry *> dead;
+    long long now = now_ms();
+    //查找用的键按线程复用，路径超出短字符串长度时也不必每次申请内存
+    static thread_local std::string key;
+    key.assign(path);
+
+    m_lock.lock();
+    entry = NULL;
+    std::unordered_map<std::string, file_entry *>::iterator it = m_map.find(key);
+    if (it != m_map.end())
+    {
+        entry = it->second;
+        entry->refs++;
+        m_lru.splice(m_lru.begin(), m_lru, entry->lru);
+        //过期条目由第一个访问的线程重新确认，其它线程在此期间继续使用
+        bool expired = now - entry->checked >= TTL_MS;
+        if (expired)
+            entry->checked = now;
+        m_lock.unlock();
+
+        if (expired && !fresh(entry))
+        {
+            m_lock.lock();
+            if (entry->cached && remove(entry))
+                dead.push_back(entry);
+            if (--entry->refs == 0)
+                dead.push_back(entry);
+            m_lock.unlock();
+            entry = NULL;
+        }
+    }
+    else
+    {
+        m_lock.unlock();
+    }
+
+    //未命中或文件已变化：在锁外加载，再放入缓存
+    if (!entry)
+    {
+        entry = load(path, map);
+        entry->refs = 1;
+        if (entry->st.st_size <= MAX_FILE && cacheable(entry))
+        {
+            m_lock.lock();
+            //其它线程已经加载了同一路径，以本次加载的为准
+            it = m_map.find(key);
+            if (it != m_map.end() && remove(it->second))
+                dead.push_back(it->second);
+            entry->refs++;
+            entry->cached = true;
+            m_lru.push_front(entry);
+            entry->lru = m_lru.begin();
+            m_map[entry->path] = entry;
+            m_bytes += entry->st.st_size;
+            //超出上限时从最久未使用的条目开始淘汰，正在发送的条目等引用释放后再销毁
+            while ((m_bytes > MAX_BYTES || (int)m_map.size() > m_max_entries) && m_lru.back() != entry)
+            {
+                file_entry *victim = m_lru.back();
+                if (remove(victim))
+                    dead.push_back(victim);
+            }
+            m_lock.unlock();
+        }
+    }
+
+    for (size_t i = 0; i < dead.size(); ++i)
+        destroy(dead[i]);
+
+    int err = entry->err;
+    if (err)
+    {
+        release(entry);
+        entry = NULL;
+    }
+    return err;
+}
+
+const std::string *file_cache::get_response(file_entry *entry, bool linger)
+{
+    const std::string *response = NULL;
+    m_lock.lock();
+    if (!entry->response[linger].empty())
+        response = &entry->response[linger];
+    m_lock.unlock();
+    if (response)
+        m_hits++;
+    else
+        m_misses++;
+    return response;
+}
+
+const std::string *file_cache::set_response(file_entry *entry, bool linger, std::string &response)
+{
+    m_lock.lock();
+    if (entry->response[linger].empty())
+    {
+        entry->response[linger].swap(response);
+        if (entry->cached)
+            m_bytes += entry->response[linger].size();
+    }
+    m_lock.unlock();
+    return &entry->response[linger];
+}
+
+void file_cache::release(file_entry *entry)
+{
+    if (!entry)
+        return;
+    m_lock.lock();
+    bool dead = --entry->refs == 0;
+    m_lock.unlock();
+    if (dead)
+        destroy(entry);
+}
+
+const std::string *file_cache::get_encoded(file_entry *entry, int encoding)
+{
+    int state = entry->encode_state.load(std::memory_order_acquire);
+    if (ENCODE_DONE == state)
+        return entry->encoded[encoding].empty() ? NULL : &entry->encoded[encoding];
+
+    //只压缩缓存中的条目，不缓存的大文件每个请求单独加载，压缩结果无法复用
+    int expected = ENCODE_NONE;
+    if (entry->cached && entry->addr && entry->st.st_size >= MIN_COMPRESS &&
+        entry->encode_state.compare_exchange_strong(expected, ENCODE_PENDING))
+    {
+        //压缩期间由队列持有一个引用，条目被淘汰后映射仍然有效
+        m_lock.lock();
+        entry->refs++;
+        m_lock.unlock();
+        if (!compressor::get_instance()->submit(entry))
+        {
+            entry->encode_state = ENCODE_NONE;
+            release(entry);
+        }
+    }
+    return NULL;
+}
+
+void file_cache::set_encoded(file_entry *entry, std::string *encoded)
+{
+    m_lock.lock();
+    for (int i = 0; i < ENCODING_NUM; ++i)
+    {
+        entry->encoded[i].swap(encoded[i]);
+        if (entry->cached)
+            m_bytes += entry->encoded[i].size();
+    }
+    m_lock.unlock();
+    //副本写入完成后再发布状态，请求线程看到ENCODE_DONE后无需加锁即可读取副本
+    entry->encode_state.store(ENCODE_DONE, std::memory_order_release);
+}
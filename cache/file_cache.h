@@ -0,0 +1,122 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <string>
+#include <list>
+#include <atomic>
+#include <unordered_map>
+#include "../lock/locker.h"
+
+/*************************************************************
+* 静态文件缓存：按解析后的文件路径缓存打开的描述符、mmap映射和stat信息
+* 命中时省去每个请求的stat、open、mmap、close和munmap
+* 1.引用计数：正在发送的响应各持有一个引用，条目被淘汰或失效后等最后一个引用释放时才关闭和解除映射
+* 2.失效：条目超过TTL后再次访问时重新stat，文件的inode、大小或修改时间变化则重新加载
+* 3.淘汰：LRU，缓存的文件总字节数和条目数超过上限时从最久未使用的条目开始淘汰
+* 4.负缓存：不存在的路径同样缓存TTL时长，重复的404请求不再访问文件系统
+* 5.完整响应：小文件的状态行、头部和文件内容首次请求时组装成一块连续内存，之后的请求一次send发出，
+*   文件变化时随条目一起重新加载
+* 6.压缩副本：可压缩的文件首次被协商压缩时交给后台压缩线程，生成的gzip和br副本同样随条目失效
+* 单例模式：所有Reactor线程和工作线程共享，一把互斥锁保护，文件系统操作在锁外进行
+**************************************************************/
+
+//压缩副本的编码，作为file_entry::encoded的下标
+enum ENCODING
+{
+    ENCODING_GZIP = 0,
+    ENCODING_BR,
+    ENCODING_NUM
+};
+
+//压缩副本的状态
+enum ENCODE_STATE
+{
+    ENCODE_NONE = 0,        //尚未压缩
+    ENCODE_PENDING,         //已提交给后台压缩线程
+    ENCODE_DONE             //副本已生成，设置后不再修改
+};
+
+struct file_entry
+{
+    std::string path;
+    struct stat st;         //文件信息
+    int fd;                 //打开的描述符，sendfile使用，不存在的路径为-1
+    int err;                //加载失败的错误码，0表示成功
+    char *addr;             //只读映射，writev和io_uring使用，空文件和不映射的大文件为NULL
+    int refs;               //引用计数，缓存本身持有一个
+    bool cached;            //是否仍在缓存中
+    long long checked;      //上次确认文件未变化的时间（毫秒）
+    std::string response[2];//组装好的响应报文（Date之后的头部和内容），下标为是否保持连接，设置后不再修改
+    std::string encoded[ENCODING_NUM];  //压缩副本，下标为ENCODING，压缩后不够小时为空
+    std::atomic<int> encode_state;      //压缩副本的状态ENCODE_STATE
+    std::list<file_entry *>::iterator lru;
+};
+
+class file_cache
+{
+public:
+    static file_cache *get_instance()
+    {
+        static file_cache instance;
+        return &instance;
+    }
+
+    //查找并引用path对应的文件，成功返回0，entry须在响应发送完毕后release
+    //失败返回ENOENT（不存在）、EACCES（其他用户不可读）、EISDIR（目录），
+    //或打开、映射失败的errno（如EMFILE、ENOMEM），这类暂时性的失败不进入缓存
+    //map为false时不缓存的大文件不做映射（addr为NULL），只用描述符sendfile
+    int acquire(const char *path, file_entry *&entry, bool map = true);
+    //释放acquire得到的引用
+    void release(file_entry *entry);
+
+    //取出组装好的完整响应报文，尚未组装时返回NULL，同时统计命中和未命中次数
+    const std::string *get_response(file_entry *entry, bool linger);
+    //保存组装好的完整响应报文，其它线程已保存时沿用已有的，返回值在条目释放前有效
+    const std::string *set_response(file_entry *entry, bool linger, std::string &response);
+    //完整响应的命中和未命中次数
+    unsigned long hits() const { return m_hits; }
+    unsigned long misses() const { return m_misses; }
+
+    //取出压缩副本，已生成且足够小时返回副本，否则返回NULL
+    //尚未压缩的缓存条目交给后台压缩线程，本次请求仍使用原始内容
+    const std::string *get_encoded(file_entry *entry, int encoding);
+    //后台压缩线程保存生成的副本，encoded为ENCODING_NUM个副本，内容被交换走
+    void set_encoded(file_entry *entry, std::string *encoded);
+
+    //设置条目数上限，启动时按文件描述符上限调整，不超过MAX_ENTRIES
+    void set_max_entries(int max_entries) { m_max_entries = max_entries; }
+    int max_entries() const { return m_max_entries; }
+
+public:
+    static const int TTL_MS = 2000;                 //条目有效期，过期后重新stat确认
+    static const long long MAX_BYTES = 64LL << 20;  //缓存的文件总字节数上限
+    static const int MAX_ENTRIES = 1024;            //条目数上限的默认值，同时限制缓存占用的描述符数
+    static const long long MAX_FILE = 8LL << 20;    //超过该大小的文件不缓存，每个请求单独打开
+    static const int MAX_RESPONSE_FILE = 16 * 1024;  //不超过该大小的文件缓存完整响应报文
+    static const int MIN_COMPRESS = 256;            //小于该大小的文件压缩收益不足，不生成压缩副本
+
+private:
+    file_cache();
+    ~file_cache();
+
+    //在锁外打开并映射文件，失败的条目fd为-1，err为对应的错误码
+    file_entry *load(const char *path, bool map);
+    //是否与文件系统中的文件一致
+    bool fresh(file_entry *entry);
+    //从缓存中移除并释放缓存自身的引用，须持锁调用，返回条目是否需要销毁
+    bool remove(file_entry *entry);
+    //关闭描述符、解除映射
+    void destroy(file_entry *entry);
+
+private:
+    locker m_lock;
+    std::unordered_map<std::string, file_entry *> m_map;
+    std::list<file_entry *> m_lru;  //表头为最近使用
+    long long m_bytes;              //缓存的文件和完整响应报文总字节数
+    int m_max_entries;              //条目数上限
+    std::atomic<unsigned long> m_hits;
+    std::atomic<unsigned long> m_misses;
+};
+
+#endif
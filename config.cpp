@@ -30,11 +30,53 @@ Config::Config(){
 
     //并发模型,默认是proactor
     actor_model = 0;
+
+    //子Reactor数量,默认0,即单Reactor
+    reactor_num = 0;
+
+    //SO_REUSEPORT分片监听,默认不开启
+    reuseport = 0;
+
+    //监听队列长度,默认1024
+    backlog = 1024;
+
+    //I/O后端,默认epoll,1为io_uring
+    io_backend = 0;
+
+    //定时器链表检查周期,默认500毫秒
+    tick_ms = 500;
+
+    //忙轮询时长,默认0,即不开启
+    busy_poll = 0;
+
+    //Cache-Control策略,默认为空,即不发送Cache-Control
+    //格式为分号分隔的"路径前缀=取值"，如"/static/=public, max-age=86400;/=no-cache"
+    cache_control = "";
+
+    //消息体长度上限,默认64MB,超过的请求返回413
+    max_body = 64;
+
+    //每个连接每轮写事件最多发送的字节数（KB）,默认1024KB（一次sendfile的块大小）,0表示不限制
+    write_quota = 1024;
+
+    //各阶段的时限（秒）：接收请求头部默认10秒，接收消息体默认60秒，长连接空闲默认15秒
+    header_timeout = 10;
+    body_timeout = 60;
+    idle_timeout = 15;
+
+    //发送响应的最低平均速率（KB/s）,默认1KB/s,0表示只要求每10秒有发送进展
+    min_send_rate = 1;
+
+    //每个长连接最多处理的请求数,默认100,0表示不限制
+    max_requests = 100;
+
+    //空闲长连接数上限,默认0,即不单独限制（连接数接近上限时仍会淘汰空闲最久的长连接）
+    max_idle = 0;
 }
 
 void Config::parse_arg(int argc, char*argv[]){
     int opt;
-    const char *str = "p:l:m:o:s:t:c:a:";
+    const char *str = "p:l:m:o:s:t:c:a:r:u:b:i:k:y:e:z:w:h:d:n:g:q:x:";
     while ((opt = getopt(argc, argv, str)) != -1)
     {
         switch (opt)
@@ -79,6 +121,99 @@ void Config::parse_arg(int argc, char*argv[]){
             actor_model = atoi(optarg);
             break;
         }
+        case 'r':
+        {
+            reactor_num = atoi(optarg);
+            break;
+        }
+        case 'u':
+        {
+            reuseport = atoi(optarg);
+            break;
+        }
+        case 'b':
+        {
+            backlog = atoi(optarg);
+            break;
+        }
+        case 'i':
+        {
+            io_backend = atoi(optarg);
+            break;
+        }
+        case 'k':
+        {
+            tick_ms = atoi(optarg);
+            if (tick_ms <= 0)
+                tick_ms = 500;
+            break;
+        }
+        case 'y':
+        {
+            busy_poll = atoi(optarg);
+            break;
+        }
+        case 'e':
+        {
+            cache_control = optarg;
+            break;
+        }
+        case 'z':
+        {
+            max_body = atoi(optarg);
+            if (max_body <= 0)
+                max_body = 64;
+            break;
+        }
+        case 'w':
+        {
+            write_quota = atoi(optarg);
+            if (write_quota < 0)
+                write_quota = 1024;
+            break;
+        }
+        case 'h':
+        {
+            header_timeout = atoi(optarg);
+            if (header_timeout <= 0)
+                header_timeout = 10;
+            break;
+        }
+        case 'd':
+        {
+            body_timeout = atoi(optarg);
+            if (body_timeout <= 0)
+                body_timeout = 60;
+            break;
+        }
+        case 'n':
+        {
+            idle_timeout = atoi(optarg);
+            if (idle_timeout <= 0)
+                idle_timeout = 15;
+            break;
+        }
+        case 'g':
+        {
+            min_send_rate = atoi(optarg);
+            if (min_send_rate < 0)
+                min_send_rate = 1;
+            break;
+        }
+        case 'q':
+        {
+            max_requests = atoi(optarg);
+            if (max_requests < 0)
+                max_requests = 100;
+            break;
+        }
+        case 'x':
+        {
+            max_idle = atoi(optarg);
+            if (max_idle < 0)
+                max_idle = 0;
+            break;
+        }
         default:
             break;
         }
@@ -42,6 +42,47 @@ public:
 
     //并发模型选择
     int actor_model;
+
+    //子Reactor数量（主从Reactor模式）
+    int reactor_num;
+
+    //是否为每个子Reactor开启SO_REUSEPORT监听socket
+    int reuseport;
+
+    //监听队列长度
+    int backlog;
+
+    //I/O后端选择
+    int io_backend;
+
+    //定时器链表检查周期（毫秒）
+    int tick_ms;
+
+    //事件循环忙轮询时长（微秒）
+    int busy_poll;
+
+    //按路径前缀配置的Cache-Control策略
+    string cache_control;
+
+    //请求消息体长度上限（MB）
+    int max_body;
+
+    //每轮写事件的发送配额（KB），0表示不限制
+    int write_quota;
+
+    //接收请求头部、接收消息体、长连接空闲的时限（秒）
+    int header_timeout;
+    int body_timeout;
+    int idle_timeout;
+
+    //发送响应的最低平均速率（KB/s），0表示不限制
+    int min_send_rate;
+
+    //每个长连接最多处理的请求数，0表示不限制
+    int max_requests;
+
+    //空闲长连接数上限，0表示不限制
+    int max_idle;
 };
 
 #endif
\ No newline at end of file
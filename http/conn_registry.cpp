@@ -0,0 +1,52 @@
+#include "conn_registry.h"
+
+conn_registry::conn_registry()
+{
+    m_index = NULL;
+    m_max_fd = 0;
+}
+
+conn_registry::~conn_registry()
+{
+    for (size_t i = 0; i < m_slabs.size(); ++i)
+        delete[] m_slabs[i];
+    free(m_index);
+}
+
+void conn_registry::init(int max_fd)
+{
+    m_max_fd = max_fd;
+    //calloc得到的大块内存由零页映射，只有实际用到的描述符对应的页才会占用物理内存
+    m_index = (http_conn **)calloc(max_fd, sizeof(http_conn *));
+    assert(m_index != NULL);
+}
+
+//fd须小于init时的max_fd，由accept处检查
+http_conn *conn_registry::acquire(int fd)
+{
+    assert(fd >= 0 && fd < m_max_fd);
+    m_lock.lock();
+    //空闲链表为空时再申请一个slab
+    if (m_free.empty())
+    {
+        http_conn *slab = new http_conn[SLAB_SIZE];
+        m_slabs.push_back(slab);
+        for (int i = SLAB_SIZE - 1; i >= 0; --i)
+            m_free.push_back(slab + i);
+    }
+    http_conn *conn = m_free.back();
+    m_free.pop_back();
+    m_index[fd] = conn;
+    m_lock.unlock();
+    return conn;
+}
+
+//须在关闭描述符之前调用，否则描述符被其它线程的新连接复用后，索引会被错误清除
+void conn_registry::release(http_conn *conn, int fd)
+{
+    m_lock.lock();
+    if (m_index[fd] == conn)
+        m_index[fd] = NULL;
+    m_free.push_back(conn);
+    m_lock.unlock();
+}
@@ -0,0 +1,53 @@
+#ifndef CONN_REGISTRY_H
+#define CONN_REGISTRY_H
+
+#include <vector>
+#include "http_conn.h"
+#include "../lock/locker.h"
+
+/*************************************************************
+* 连接注册表：accept时从slab中按需分配http_conn对象，连接关闭时归还到空闲链表
+* 取代启动时一次性new http_conn[MAX_FD]：每个对象自带读写缓冲区，65536个对象在第一个请求之前就占用数百MB内存
+* 工作线程持有连接期间（已分发、尚未收到完成消息）不归还，由cb_func推迟到最后一个完成消息到达后，避免新连接复用仍在使用的缓冲区
+* epoll事件通过data.ptr直接携带连接对象，只有io_uring等仅持有描述符的场景才需要通过find按描述符查找
+* 单例模式：accept和关闭连接可能发生在不同的Reactor线程中，共享同一个注册表
+**************************************************************/
+
+class conn_registry
+{
+public:
+    static conn_registry *get_instance()
+    {
+        static conn_registry instance;
+        return &instance;
+    }
+
+    //max_fd为描述符上限，按描述符索引的指针表在此分配
+    void init(int max_fd);
+    //为新接受的连接分配连接对象
+    http_conn *acquire(int fd);
+    //连接关闭后归还连接对象
+    void release(http_conn *conn, int fd);
+    //按描述符查找连接对象，未注册返回NULL
+    http_conn *find(int fd)
+    {
+        if (fd < 0 || fd >= m_max_fd)
+            return NULL;
+        return m_index[fd];
+    }
+
+private:
+    conn_registry();
+    ~conn_registry();
+
+private:
+    static const int SLAB_SIZE = 64;    //每次向系统申请的连接对象个数
+
+    locker m_lock;
+    std::vector<http_conn *> m_slabs;   //已申请的slab
+    std::vector<http_conn *> m_free;    //空闲连接对象
+    http_conn **m_index;                //描述符到连接对象的索引
+    int m_max_fd;
+};
+
+#endif
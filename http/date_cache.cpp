@@ -0,0 +1,65 @@
+#include "date_cache.h"
+#include <string.h>
+
+date_cache::date_cache() : m_current(0), m_second(0)
+{
+    m_updating.clear();
+    update();
+}
+
+void date_cache::update()
+{
+    time_t now = time(NULL);
+    if (now == m_second.load(std::memory_order_relaxed))
+        return;
+    //其他线程正在更新时直接返回，使用上一秒的值
+    if (m_updating.test_and_set(std::memory_order_acquire))
+        return;
+    if (now != m_second.load(std::memory_order_relaxed))
+    {
+        int next = (m_current.load(std::memory_order_relaxed) + 1) % SLOTS;
+        char *line = m_slots[next];
+        memcpy(line, "Date:", 5);
+        format(now, line + 5);
+        memcpy(line + 5 + DATE_LEN, "\r\n", 2);
+        m_current.store(next, std::memory_order_release);
+        m_second.store(now, std::memory_order_relaxed);
+    }
+    m_updating.clear(std::memory_order_release);
+}
+
+//两位数字
+static inline char *put2(char *p, int v)
+{
+    p[0] = '0' + v / 10;
+    p[1] = '0' + v % 10;
+    return p + 2;
+}
+
+void date_cache::format(time_t t, char *buf)
+{
+    static const char *week = "SunMonTueWedThuFriSat";
+    static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char *p = buf;
+    memcpy(p, week + tm.tm_wday * 3, 3);
+    p += 3;
+    *p++ = ',';
+    *p++ = ' ';
+    p = put2(p, tm.tm_mday);
+    *p++ = ' ';
+    memcpy(p, months + tm.tm_mon * 3, 3);
+    p += 3;
+    *p++ = ' ';
+    int year = tm.tm_year + 1900;
+    p = put2(p, year / 100 % 100);
+    p = put2(p, year % 100);
+    *p++ = ' ';
+    p = put2(p, tm.tm_hour);
+    *p++ = ':';
+    p = put2(p, tm.tm_min);
+    *p++ = ':';
+    p = put2(p, tm.tm_sec);
+    memcpy(p, " GMT", 4);
+}
@@ -0,0 +1,49 @@
+#ifndef DATE_CACHE_H
+#define DATE_CACHE_H
+
+#include <atomic>
+#include <time.h>
+
+/*************************************************************
+* Date响应头部缓存：事件循环每轮调用update，秒数变化时格式化一次完整的"Date:...\r\n"行
+* 生成响应时只需拷贝固定长度的一行，不再调用gmtime/strftime
+* 多个事件循环线程（主Reactor、子Reactor、io_uring）共享一份，同一时刻只有一个线程更新
+* 使用多个槽位轮流写入：新的一行写入下一个槽位后再发布，读者拿到的槽位在几秒内不会被改写
+**************************************************************/
+
+class date_cache
+{
+public:
+    static date_cache *get_instance()
+    {
+        static date_cache instance;
+        return &instance;
+    }
+
+    //秒数变化时重新格式化，由事件循环在每次等待返回后调用
+    void update();
+    //当前的Date头部行，长度为LINE_LEN，不以'\0'结束
+    const char *line() const
+    {
+        return m_slots[m_current.load(std::memory_order_acquire)];
+    }
+
+    //按HTTP日期格式（IMF-fixdate）格式化时间，写入DATE_LEN个字符，不以'\0'结束
+    static void format(time_t t, char *buf);
+
+public:
+    static const int DATE_LEN = 29;                 //"Sun, 18 Oct 2026 07:34:59 GMT"
+    static const int LINE_LEN = DATE_LEN + 7;       //"Date:" + 日期 + "\r\n"
+    static const int SLOTS = 4;
+
+private:
+    date_cache();
+
+private:
+    char m_slots[SLOTS][LINE_LEN];
+    std::atomic<int> m_current;
+    std::atomic<time_t> m_second;
+    std::atomic_flag m_updating;
+};
+
+#endif
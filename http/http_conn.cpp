@@ -2,23 +2,178 @@
 
 #include <mysql/mysql.h>
 #include <fstream>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <algorithm>
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
+const char *ok_206_title = "Partial Content";
+const char *not_modified_304_title = "Not Modified";
 const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to staisfy.\n";
 const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
 const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
+const char *error_413_title = "Payload Too Large";
+const char *error_413_form = "The request body exceeds the size limit of this server.\n";
+const char *error_416_title = "Range Not Satisfiable";
+const char *error_416_form = "The requested range is outside the file on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
 
 locker m_lock;
-map<string, string> users;
+//用户名作为键，透明比较器使查找可以直接使用char数组，不构造临时string
+map<string, string, std::less<> > users;
 
-void http_conn::initmysql_result(connection_pool *connPool)
+//多区间响应的分隔符
+const char *byteranges_boundary = "3d6b6a416f9b5";
+
+//两位十进制数字表，整数格式化每次除以100，减少一半的除法
+static const char digit_pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+//十进制整数写入buf（不以'\0'结束），返回长度
+static int format_number(unsigned long long v, char *buf)
 {
+    char tmp[20];
+    char *p = tmp + sizeof(tmp);
+    while (v >= 100)
+    {
+        const char *d = digit_pairs + (v % 100) * 2;
+        v /= 100;
+        *--p = d[1];
+        *--p = d[0];
+    }
+    if (v >= 10)
+    {
+        const char *d = digit_pairs + v * 2;
+        *--p = d[1];
+        *--p = d[0];
+    }
+    else
+        *--p = '0' + v;
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+//十进制整数的位数，用于预先计算消息体长度
+static int number_len(unsigned long long v)
+{
+    int len = 1;
+    for (; v >= 10; v /= 10)
+        ++len;
+    return len;
+}
+
+//十六进制整数写入buf（不以'\0'结束），返回长度
+static int format_hex(unsigned long long v, char *buf)
+{
+    static const char hex[] = "0123456789abcdef";
+    char tmp[16];
+    char *p = tmp + sizeof(tmp);
+    do
+    {
+        *--p = hex[v & 0xf];
+        v >>= 4;
+    } while (v);
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+//按HTTP日期格式（IMF-fixdate）格式化时间，用于Last-Modified和If-Range比较
+static void http_date(time_t t, char *buf, int size)
+{
+    if (size <= date_cache::DATE_LEN)
+        return;
+    date_cache::format(t, buf);
+    buf[date_cache::DATE_LEN] = '\0';
+}
+
+//由文件的inode、修改时间和大小生成ETag，文件被替换或修改后随之变化
+//buf至少64字节：三个十六进制数最多48个字符
+static void file_etag(const struct stat &st, char *buf)
+{
+    char *p = buf;
+    *p++ = '"';
+    p += format_hex((unsigned long long)st.st_ino, p);
+    *p++ = '-';
+    p += format_hex((unsigned long long)st.st_mtime, p);
+    *p++ = '-';
+    p += format_hex((unsigned long long)st.st_size, p);
+    *p++ = '"';
+    *p = '\0';
+}
+
+//可压缩的文本类型，按扩展名判断
+static bool compressible(const char *path)
+{
+    static const char *exts[] = {".html", ".htm", ".css", ".js", ".json", ".txt", ".svg", ".xml"};
+    const char *ext = strrchr(path, '.');
+    if (!ext || strchr(ext, '/'))
+        return false;
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); ++i)
+    {
+        if (strcasecmp(ext, exts[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+//Accept-Encoding中是否接受name编码，q=0表示明确拒绝
+static bool accepts_encoding(const char *list, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = list;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        size_t token = strcspn(p, " \t,;");
+        if ((token == len && strncasecmp(p, name, len) == 0) || (1 == token && '*' == *p))
+        {
+            const char *q = p + token;
+            const char *end = q + strcspn(q, ",");
+            q += strspn(q, " \t");
+            if (';' == *q)
+            {
+                q += 1 + strspn(q + 1, " \t");
+                if ((strncasecmp(q, "q=", 2) == 0) && atof(q + 2) <= 0 && q + 2 < end)
+                    return false;
+            }
+            return true;
+        }
+        p += strcspn(p, ",");
+    }
+    return false;
+}
+
+//If-None-Match中是否有与etag匹配的实体标签，使用弱比较（忽略W/前缀）
+static bool etag_match(const char *list, const char *etag)
+{
+    size_t len = strlen(etag);
+    const char *p = list;
+    while (*p)
+    {
+        p += strspn(p, " \t,");
+        if ('*' == *p)
+            return true;
+        if (strncmp(p, "W/", 2) == 0)
+            p += 2;
+        if (strncmp(p, etag, len) == 0 && strchr(" \t,", p[len]))
+            return true;
+        p += strcspn(p, ",");
+    }
+    return false;
+}
+
+void http_conn::initmysql_result(connection_pool *connPool, int close_log)
+{
+    //日志宏使用m_close_log
+    int m_close_log = close_log;
+
     //先从连接池中取一个连接
     MYSQL *mysql = NULL;
     connectionRAII mysqlcon(&mysql, connPool);
@@ -47,20 +202,12 @@ void http_conn::initmysql_result(connection_pool *connPool)
     }
 }
 
-//对文件描述符设置非阻塞
-int setnonblocking(int fd)
-{
-    int old_option = fcntl(fd, F_GETFL);
-    int new_option = old_option | O_NONBLOCK;
-    fcntl(fd, F_SETFL, new_option);
-    return old_option;
-}
-
 //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
+//ptr为连接对象，作为epoll_event.data.ptr，事件循环无需再按描述符查找
+void addfd(int epollfd, int fd, void *ptr, bool one_shot, int TRIGMode)
 {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.ptr = ptr;
 
     if (1 == TRIGMode)
         event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
@@ -69,8 +216,8 @@ void addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
 
     if (one_shot)
         event.events |= EPOLLONESHOT;
+    //连接socket由accept4创建时已是非阻塞的，无需再fcntl
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    setnonblocking(fd);
 }
 
 //从内核时间表删除描述符
@@ -81,10 +228,13 @@ void removefd(int epollfd, int fd)
 }
 
 //将事件重置为EPOLLONESHOT
-void modfd(int epollfd, int fd, int ev, int TRIGMode)
+void modfd(int epollfd, int fd, void *ptr, int ev, int TRIGMode)
 {
+    //io_uring后端的连接没有注册到epoll，由事件循环根据完成通知决定下一步操作
+    if (epollfd == -1)
+        return;
     epoll_event event;
-    event.data.fd = fd;
+    event.data.ptr = ptr;
 
     if (1 == TRIGMode)
         event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
@@ -96,8 +246,46 @@ void modfd(int epollfd, int fd, int ev, int TRIGMode)
 
 
 /*------------------------------http_conn相关代码-------------------------*/
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count(0);
+std::atomic<int> http_conn::m_uploads(0);
+std::atomic<bool> http_conn::m_draining(false);
+std::vector<std::pair<string, string> > http_conn::m_cache_control;
+long long http_conn::m_max_body = 64LL << 20;
+route_table<http_conn::route> http_conn::m_routes;
+long long http_conn::m_write_quota = 1LL << 20;
+std::atomic<unsigned long long> http_conn::m_write_yields(0);
+int http_conn::m_header_timeout = 10000;
+int http_conn::m_body_timeout = 60000;
+int http_conn::m_idle_timeout = 15000;
+long long http_conn::m_min_send_rate = 1024;
+int http_conn::m_max_requests = 100;
+int http_conn::m_busy_conns = INT_MAX;
+std::atomic<unsigned long long> http_conn::m_idle_evictions(0);
+
+//按前缀从长到短排列，查找时第一个匹配的即为最长匹配
+static bool longer_prefix(const std::pair<string, string> &a, const std::pair<string, string> &b)
+{
+    return a.first.size() > b.first.size();
+}
+
+void http_conn::init_cache_control(const string &spec)
+{
+    m_cache_control.clear();
+    size_t start = 0;
+    while (start < spec.size())
+    {
+        size_t end = spec.find(';', start);
+        if (end == string::npos)
+            end = spec.size();
+        string item = spec.substr(start, end - start);
+        //前缀与取值以第一个'='分隔，取值本身可以包含'='（如max-age=3600）
+        size_t eq = item.find('=');
+        if (eq != string::npos && eq > 0)
+            m_cache_control.push_back(std::make_pair(item.substr(0, eq), item.substr(eq + 1)));
+        start = end + 1;
+    }
+    std::stable_sort(m_cache_control.begin(), m_cache_control.end(), longer_prefix);
+}
 
 //关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close)
@@ -112,18 +300,22 @@ void http_conn::close_conn(bool real_close)
 }
 
 //初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMode,
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd, char *root, int TRIGMode,
                      int close_log, string user, string passwd, string sqlname)
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_epollfd = epollfd;
+    m_serial++;
+    //连接对象从slab中复用，注册事件前先设置本连接的触发模式
+    m_TRIGMode = TRIGMode;
 
-    addfd(m_epollfd, sockfd, true, m_TRIGMode);
+    if (m_epollfd != -1)
+        addfd(m_epollfd, sockfd, this, true, m_TRIGMode);
     m_user_count++;
 
     //当浏览器出现连接重置时，可能是网站根目录出错或http响应格式出错或者访问的文件中内容完全为空
     doc_root = root;
-    m_TRIGMode = TRIGMode;
     m_close_log = close_log;
 
     strcpy(sql_user, user.c_str());
@@ -140,6 +332,9 @@ void http_conn::init()
     mysql = NULL;
     bytes_to_send = 0;
     bytes_have_send = 0;
+    m_request_count = 0;
+    //新连接从接收第一个请求的头部开始计时
+    set_phase(PHASE_HEADER);
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
     m_method = GET;
@@ -147,25 +342,115 @@ void http_conn::init()
     m_version = 0;
     m_content_length = 0;
     m_host = 0;
+    m_header_count = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_accept_encoding = 0;
+    m_encoding = NULL;
+    m_encoded = NULL;
+    m_vary = false;
+    m_range_count = 0;
     m_start_line = 0;
     m_checked_idx = 0;
     m_read_idx = 0;
     m_write_idx = 0;
     cgi = 0;
     m_state = 0;
-    timer_flag = 0;
-    improv = 0;
+    m_keep_alive = false;
+    m_body_left = 0;
+    m_upload_count = 0;
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
+    //连接关闭时已经释放，这里只是保证新连接从空状态开始
+    release_resources();
     memset(m_real_file, '\0', FILENAME_LEN);
 }
 
+void http_conn::release_resources()
+{
+    free_buffers();
+    unmap();
+    end_body();
+}
+
+void http_conn::free_read_buf()
+{
+    buffer_pool::get_instance()->release(m_read_buf, m_read_size);
+    m_read_buf = NULL;
+    m_read_size = 0;
+}
+
+void http_conn::free_write_buf()
+{
+    buffer_pool::get_instance()->release(m_write_buf, m_write_size);
+    m_write_buf = NULL;
+    m_write_size = 0;
+}
+
+void http_conn::free_buffers()
+{
+    free_read_buf();
+    free_write_buf();
+}
+
+//读缓冲区写满时换用更大一级的缓冲区
+//请求行和头部的解析结果是指向读缓冲区的指针，需要平移到新缓冲区
+bool http_conn::grow_read_buf()
+{
+    int size = m_read_size ? m_read_size * 2 : READ_BUFFER_SIZE;
+    if (size > MAX_READ_BUFFER_SIZE)
+        return false;
+    int capacity;
+    char *buf = buffer_pool::get_instance()->alloc(size, capacity);
+    if (!buf)
+        return false;
+    if (m_read_buf)
+    {
+        memcpy(buf, m_read_buf, m_read_idx);
+        if (m_url)
+            m_url = buf + (m_url - m_read_buf);
+        if (m_version)
+            m_version = buf + (m_version - m_read_buf);
+        if (m_host)
+            m_host = buf + (m_host - m_read_buf);
+        buffer_pool::get_instance()->release(m_read_buf, m_read_size);
+    }
+    m_read_buf = buf;
+    m_read_size = capacity;
+    return true;
+}
+
+//写缓冲区写满时换用更大一级的缓冲区，此时iovec尚未指向写缓冲区
+bool http_conn::grow_write_buf()
+{
+    int size = m_write_size ? m_write_size * 2 : WRITE_BUFFER_SIZE;
+    int capacity;
+    char *buf = buffer_pool::get_instance()->alloc(size, capacity);
+    if (!buf)
+        return false;
+    if (m_write_buf)
+    {
+        memcpy(buf, m_write_buf, m_write_idx);
+        buffer_pool::get_instance()->release(m_write_buf, m_write_size);
+    }
+    m_write_buf = buf;
+    m_write_size = capacity;
+    return true;
+}
+
 //循环读取客户数据，直到无数据可读或对方关闭连接
 //非阻塞ET工作模式下，需要一次性将数据读完
+//读缓冲区始终保留最后一个字节存放'\0'，保证解析消息体时不越界
 bool http_conn::read_once()
 {
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    wake();
+    //流式接收消息体期间，数据直接从套接字搬运到临时文件
+    if (m_body_left > 0)
+        return read_body();
+
+    //缓冲区已满（或尚未借用缓冲区），换用更大一级的缓冲区，已达上限则拒绝该请求
+    if (m_read_idx >= m_read_size - 1 && !grow_read_buf())
     {
         return false;
     }
@@ -176,22 +461,32 @@ bool http_conn::read_once()
     {
         //系统调用recv从通信socket中读取数据，返回读取的字节数
 		//arg2：缓冲区位置；arg3：缓冲区大小
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-        m_read_idx += bytes_read;
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
         //读取失败
         if (bytes_read <= 0)
         {
             return false;
         }
+        m_read_idx += bytes_read;
+        m_read_buf[m_read_idx] = '\0';
 
         return true;
     }
     //ET读数据
     else
     {
+        bool got = false;
         while (true)
         {
-            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+            //缓冲区已达上限：本次已读到数据时先交给解析（可能转为流式接收消息体），
+            //剩余数据在重新注册事件时（EPOLL_CTL_MOD）会再次触发读事件
+            if (m_read_idx >= m_read_size - 1 && !grow_read_buf())
+            {
+                if (got)
+                    break;
+                return false;
+            }
+            bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
             if (bytes_read == -1)
             {
                 if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -203,11 +498,51 @@ bool http_conn::read_once()
                 return false;
             }
             m_read_idx += bytes_read;
+            m_read_buf[m_read_idx] = '\0';
+            got = true;
         }
         return true;
     }
 }
 
+//io_uring后端：数据已由内核收入缓冲区环，这里只需拷贝到读缓冲区
+int http_conn::append_read(const char *data, int len)
+{
+    int used = 0;
+    if (len > 0)
+        wake();
+    //流式接收消息体期间，消息体部分写入临时文件，之后的流水线数据进入读缓冲区
+    if (m_body_left > 0)
+    {
+        int n = m_body_left < len ? m_body_left : len;
+        for (int done = 0; done < n;)
+        {
+            int ret = ::write(m_body_fd, data + done, n - done);
+            if (ret <= 0)
+                return -1;
+            done += ret;
+        }
+        m_body_left -= n;
+        data += n;
+        len -= n;
+        used = n;
+    }
+    if (len <= 0)
+        return used;
+    //读缓冲区扩大到上限仍放不下时，只追加放得下的部分
+    while (m_read_idx + len > m_read_size - 1 && grow_read_buf())
+        ;
+    int n = m_read_size - 1 - m_read_idx;
+    if (n > len)
+        n = len;
+    if (n <= 0)
+        return used;
+    memcpy(m_read_buf + m_read_idx, data, n);
+    m_read_idx += n;
+    m_read_buf[m_read_idx] = '\0';
+    return used + n;
+}
+
 /*------------------------从状态机，用于分析出一行内容----------------------*/
 /*返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN*/
 
@@ -215,43 +550,37 @@ bool http_conn::read_once()
 //m_checked_idx指向从状态机当前正在分析的字节
 http_conn::LINE_STATUS http_conn::parse_line()
 {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx)
+    //用SIMD一次比较多个字节，直接定位下一个'\r'或'\n'
+    const char *end = m_read_buf + m_read_idx;
+    const char *eol = http_scanner::find_eol(m_read_buf + m_checked_idx, end);
+    m_checked_idx = eol - m_read_buf;
+    //并没有找到\r\n，请求不完整，需要继续接收
+    if (eol == end)
+        return LINE_OPEN;
+    //如果当前是\r字符，则有可能会读取到完整行
+    if (*eol == '\r')
     {
-        //temp为将要分析的字节
-        temp = m_read_buf[m_checked_idx];
-        //如果当前是\r字符，则有可能会读取到完整行
-        if (temp == '\r')
-        {
-            //到达末尾但没读到\n，说明不是完整行，需要继续读
-            if ((m_checked_idx + 1) == m_read_idx)
-                return LINE_OPEN;
-            //下一个字符是\n，将\r\n改为\0\0
-            else if (m_read_buf[m_checked_idx + 1] == '\n')
-            {
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                //如果都不符合，则返回语法错误
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        }
-        //如果当前字符是\n，也有可能读取到完整行
-        //一般是上次读取到\r就到buffer末尾了，没有接收完整，再次接收时会出现这种情况
-        else if (temp == '\n')
+        //到达末尾但没读到\n，说明不是完整行，需要继续读，下次从\r处重新判断
+        if ((m_checked_idx + 1) == m_read_idx)
+            return LINE_OPEN;
+        //下一个字符是\n，将\r\n改为\0\0
+        else if (m_read_buf[m_checked_idx + 1] == '\n')
         {
-            //前一个字符是\r，则接收完整
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
-            {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
         }
+        //如果都不符合，则返回语法错误
+        return LINE_BAD;
     }
-    //并没有找到\r\n，请求不完整，需要继续接收
-    return LINE_OPEN;
+    //单独的\n：前一个字符是\r则接收完整
+    if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r')
+    {
+        m_read_buf[m_checked_idx - 1] = '\0';
+        m_read_buf[m_checked_idx++] = '\0';
+        return LINE_OK;
+    }
+    return LINE_BAD;
 }
 /*--------------------------------------------------------------------*/
 
@@ -313,9 +642,6 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     //一般的不会带有上述两种符号，直接是单独的/或/后面带访问资源
     if (!m_url || m_url[0] != '/')
         return BAD_REQUEST;
-    //当url为/时，显示判断界面
-    if (strlen(m_url) == 1)
-        strcat(m_url, "judge.html");
     
     //请求行解析完毕，主状态机从CHECK_STATE_REQUESTLINE切换到CHECK_STATE_HEADER状态
     m_check_state = CHECK_STATE_HEADER;
@@ -332,51 +658,90 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
         //需要读取m_content_length字节的消息体，状态机转移到CHECK_STATE_CONTENT状态
         if (m_content_length != 0)
         {
+            //超过上限的消息体不再接收，响应413后关闭连接
+            if (m_content_length > m_max_body)
+            {
+                m_linger = false;
+                return PAYLOAD_TOO_LARGE;
+            }
             //POST需要跳转到消息体处理状态
             m_check_state = CHECK_STATE_CONTENT;
+            set_phase(PHASE_BODY);
+            //较大的消息体和上传的文件不进入读缓冲区，读缓冲区的大小与消息体长度无关
+            std::string boundary;
+            if ((m_content_length > BODY_BUFFER_LIMIT || multipart::get_boundary(get_header("Content-Type"), boundary)) &&
+                !start_body())
+                return INTERNAL_ERROR;
             return NO_REQUEST;
         }
         //否则说明我们已经得到了一个完整的HTTP请求
         return GET_REQUEST;
     }
+    //名称与取值以第一个':'分隔，没有':'的行忽略
+    char *colon = strchr(text, ':');
+    if (!colon)
+        return NO_REQUEST;
+    int name_len = colon - text;
+    //跳过取值前的空格和\t字符，行末已由parse_line置为\0（m_start_line之前的两个字节），从行末向前去掉尾部空白
+    char *value = colon + 1;
+    value += strspn(value, " \t");
+    char *tail = m_read_buf + m_start_line - 2;
+    while (tail > value && (tail[-1] == ' ' || tail[-1] == '\t'))
+        *--tail = '\0';
+    //记录到头部索引，其它请求头在需要时通过get_header查找
+    if (m_header_count < MAX_HEADERS)
+    {
+        header_field &field = m_headers[m_header_count++];
+        field.name = text - m_read_buf;
+        field.name_len = name_len;
+        field.value = value - m_read_buf;
+    }
+
+    //解析阶段就需要的请求头：先比较长度，再比较名称
     //解析请求头部连接字段
-    else if (strncasecmp(text, "Connection:", 11) == 0)
+    if (10 == name_len && strncasecmp(text, "Connection", 10) == 0)
     {
-        text += 11;
-        //跳过空格和\t字符
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
+        if (strcasecmp(value, "keep-alive") == 0)
         {
             //如果是长连接，则将linger标志设置为true
             m_linger = true;
         }
     }
     //解析请求头部内容长度字段
-    else if (strncasecmp(text, "Content-length:", 15) == 0)
+    else if (14 == name_len && strncasecmp(text, "Content-length", 14) == 0)
     {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
+        m_content_length = atoll(value);
+        if (m_content_length < 0)
+            return BAD_REQUEST;
     }
     //解析请求头部HOST字段
-    else if (strncasecmp(text, "Host:", 5) == 0)
+    else if (4 == name_len && strncasecmp(text, "Host", 4) == 0)
     {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+        m_host = value;
     }
-    else
+    return NO_REQUEST;
+}
+
+const char *http_conn::get_header(const char *name)
+{
+    int len = strlen(name);
+    for (int i = 0; i < m_header_count; ++i)
     {
-        LOG_INFO("oop!unknow header: %s", text);
+        if (m_headers[i].name_len == len && strncasecmp(m_read_buf + m_headers[i].name, name, len) == 0)
+            return m_read_buf + m_headers[i].value;
     }
-    return NO_REQUEST;
+    return NULL;
 }
 
 //判断http请求是否被完整读入
 http_conn::HTTP_CODE http_conn::parse_content(char *text)
 {
+    //流式接收的消息体在临时文件中，全部接收后再处理
+    if (m_body_fd != -1)
+        return m_body_left > 0 ? NO_REQUEST : GET_REQUEST;
     if (m_read_idx >= (m_content_length + m_checked_idx))
     {
+        m_content_end = text[m_content_length];
         text[m_content_length] = '\0';
         //POST请求中最后为输入的用户名和密码
         m_string = text;
@@ -384,6 +749,107 @@ http_conn::HTTP_CODE http_conn::parse_content(char *text)
     }
     return NO_REQUEST;
 }
+
+bool http_conn::start_body()
+{
+    //上传数达到上限时拒绝，计数在end_body关闭临时文件时减少
+    if (m_uploads.fetch_add(1) >= MAX_UPLOADS)
+    {
+        m_uploads--;
+        return false;
+    }
+    //O_TMPFILE创建的临时文件没有名字，关闭后自动删除；文件系统不支持时创建后立即删除
+    m_body_fd = open("/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (-1 == m_body_fd)
+    {
+        char path[] = "/tmp/webserver-body-XXXXXX";
+        m_body_fd = mkostemp(path, O_CLOEXEC);
+        if (-1 == m_body_fd)
+        {
+            m_uploads--;
+            return false;
+        }
+        unlink(path);
+    }
+    //已经读入缓冲区的部分消息体先写入文件，之后的流水线数据留在缓冲区中
+    int avail = m_read_idx - m_checked_idx;
+    int n = avail < m_content_length ? avail : m_content_length;
+    for (int done = 0; done < n;)
+    {
+        int ret = ::write(m_body_fd, m_read_buf + m_checked_idx + done, n - done);
+        if (ret <= 0)
+            return false;
+        done += ret;
+    }
+    memmove(m_read_buf + m_checked_idx, m_read_buf + m_checked_idx + n, avail - n);
+    m_read_idx -= n;
+    m_read_buf[m_read_idx] = '\0';
+    m_body_left = m_content_length - n;
+    //epoll后端用splice搬运剩余的消息体，管道创建失败时退回read/write
+    if (m_body_left > 0 && m_epollfd != -1 && pipe2(m_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+        m_pipe[0] = m_pipe[1] = -1;
+    return true;
+}
+
+bool http_conn::read_body()
+{
+    while (m_body_left > 0)
+    {
+        int len = m_body_left < BODY_CHUNK ? m_body_left : BODY_CHUNK;
+        ssize_t n;
+        if (m_pipe[0] != -1)
+        {
+            //套接字→管道→临时文件，数据只在内核的页之间移动
+            n = splice(m_sockfd, NULL, m_pipe[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            for (ssize_t done = 0; n > 0 && done < n;)
+            {
+                ssize_t ret = splice(m_pipe[0], NULL, m_body_fd, NULL, n - done, SPLICE_F_MOVE);
+                if (ret <= 0)
+                    return false;
+                done += ret;
+            }
+        }
+        else
+        {
+            //不支持splice时经过栈上的缓冲区，内存占用同样与消息体长度无关
+            char buf[16384];
+            n = recv(m_sockfd, buf, len < (int)sizeof(buf) ? len : sizeof(buf), 0);
+            for (ssize_t done = 0; n > 0 && done < n;)
+            {
+                ssize_t ret = ::write(m_body_fd, buf + done, n - done);
+                if (ret <= 0)
+                    return false;
+                done += ret;
+            }
+        }
+        if (n == 0)
+            return false;
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        m_body_left -= n;
+        //LT模式每次事件只读取一次
+        if (0 == m_TRIGMode)
+            break;
+    }
+    return true;
+}
+
+void http_conn::end_body()
+{
+    if (m_body_fd != -1)
+    {
+        close(m_body_fd);
+        m_body_fd = -1;
+        m_uploads--;
+    }
+    if (m_pipe[0] != -1)
+    {
+        close(m_pipe[0]);
+        close(m_pipe[1]);
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+    m_body_left = 0;
+}
 /*--------------------------------------------------------------------*/
 
 //process_read从m_read_buf读取，并处理请求报文
@@ -421,8 +887,8 @@ http_conn::HTTP_CODE http_conn::process_read()
             {
                 //解析请求头
                 ret = parse_headers(text);
-                if (ret == BAD_REQUEST)
-                    return BAD_REQUEST;
+                if (ret == BAD_REQUEST || ret == PAYLOAD_TOO_LARGE || ret == INTERNAL_ERROR)
+                    return ret;
                 //完整解析GET请求后，跳转到报文响应函数
                 else if (ret == GET_REQUEST)
                 {
@@ -450,298 +916,709 @@ http_conn::HTTP_CODE http_conn::process_read()
     return NO_REQUEST;
 }
 
-http_conn::HTTP_CODE http_conn::do_request()
+void http_conn::init_routes()
 {
-    //将初始化的m_real_file赋值为网站根目录
+    //当url为/时，显示判断界面
+    add_route("/", serve_page, "/judge.html");
+    //页面跳转：judge.html等页面中的表单以数字作为action
+    add_route("/0", serve_page, "/register.html");
+    add_route("/1", serve_page, "/log.html");
+    add_route("/5", serve_page, "/picture.html");
+    add_route("/6", serve_page, "/video.html");
+    add_route("/7", serve_page, "/fans.html");
+    //登录和注册校验（基于CGI）
+    add_route("/2CGISQL.cgi", handle_login);
+    add_route("/3CGISQL.cgi", handle_register);
+    //健康检查和运行统计，响应内容在内存中
+    add_route("/health", handle_health);
+    add_route("/stats", handle_stats);
+}
+
+void http_conn::add_route(const char *path, route_handler handler, const char *arg)
+{
+    route r;
+    r.handler = handler;
+    r.arg = arg;
+    m_routes.add(path, r);
+}
+
+void http_conn::set_real_file(const char *url)
+{
+    //将网站目录和url进行拼接，更新到m_real_file中
     strcpy(m_real_file, doc_root);
     int len = strlen(doc_root);
-    
-    //找到m_url中/的位置
-    const char *p = strrchr(m_url, '/');
-
-    //实现登录和注册校验（基于CGI）
-    if (cgi == 1 && (*(p + 1) == '2' || *(p + 1) == '3'))
-    {
-
-        //根据标志判断是登录检测还是注册检测
-        char flag = m_url[1];       //2-登录校验；3-注册校验
-
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url + 2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        //提取用户名和密码
-        //格式：user=123&password=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i)
-            name[i - 5] = m_string[i];
-        name[i - 5] = '\0';
-
-        int j = 0;
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j)
-            password[j] = m_string[i];
-        password[j] = '\0';
-
-        //注册校验
-        if (*(p + 1) == '3')
-        {
-            //如果是注册，先检测数据库中是否有重名的
-            //没有重名的，进行增加数据
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-            //users是一个map，存储用户名和密码
-            if (users.find(name) == users.end())
-            {
-                m_lock.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
-                m_lock.unlock();
-
-                if (!res)
-                    strcpy(m_url, "/log.html");
-                else
-                    strcpy(m_url, "/registerError.html");
-            }
-            else
-                strcpy(m_url, "/registerError.html");
+    strncpy(m_real_file + len, url, FILENAME_LEN - len - 1);
+    m_real_file[FILENAME_LEN - 1] = '\0';
+}
+
+void http_conn::set_memory_response(const char *body, int len, const char *content_type)
+{
+    m_memory_body = body;
+    m_memory_len = len;
+    m_memory_type = content_type;
+}
+
+http_conn::HTTP_CODE http_conn::serve_page(http_conn *conn, const char *page)
+{
+    conn->set_real_file(page);
+    return FILE_REQUEST;
+}
+
+bool http_conn::parse_credentials(char *name, char *password)
+{
+    if (cgi != 1 || m_body_fd != -1 || !m_string)
+        return false;
+    //格式：user=123&password=123，用户名和密码最多99个字符
+    if (strncmp(m_string, "user=", 5) != 0)
+        return false;
+    int i, j = 0;
+    for (i = 5; m_string[i] != '&' && m_string[i] != '\0' && j < 99; ++i, ++j)
+        name[j] = m_string[i];
+    name[j] = '\0';
+    if (strncmp(m_string + i, "&password=", 10) != 0)
+        return false;
+
+    j = 0;
+    for (i = i + 10; m_string[i] != '\0' && j < 99; ++i, ++j)
+        password[j] = m_string[i];
+    password[j] = '\0';
+    return true;
+}
+
+//登录校验：不是登录表单（如GET请求）时按静态文件处理
+http_conn::HTTP_CODE http_conn::handle_login(http_conn *conn, const char *)
+{
+    char name[100], password[100];
+    if (!conn->parse_credentials(name, password))
+        return FILE_REQUEST;
+    map<string, string, std::less<> >::iterator it = users.find(name);
+    if (it != users.end() && it->second == password)
+        conn->set_real_file("/welcome.html");
+    else
+        conn->set_real_file("/logError.html");
+    return FILE_REQUEST;
+}
+
+//注册校验：先检测数据库中是否有重名的，没有重名的，进行增加数据
+http_conn::HTTP_CODE http_conn::handle_register(http_conn *conn, const char *)
+{
+    char name[100], password[100];
+    if (!conn->parse_credentials(name, password))
+        return FILE_REQUEST;
+    char sql_insert[256];
+    strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
+    strcat(sql_insert, "'");
+    strcat(sql_insert, name);
+    strcat(sql_insert, "', '");
+    strcat(sql_insert, password);
+    strcat(sql_insert, "')");
+    //users是一个map，存储用户名和密码
+    if (users.find(name) == users.end())
+    {
+        m_lock.lock();
+        int res = mysql_query(conn->mysql, sql_insert);
+        users.insert(pair<string, string>(name, password));
+        m_lock.unlock();
+
+        if (!res)
+            conn->set_real_file("/log.html");
+        else
+            conn->set_real_file("/registerError.html");
+    }
+    else
+        conn->set_real_file("/registerError.html");
+    return FILE_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::handle_health(http_conn *conn, const char *)
+{
+    static const char body[] = "ok\n";
+    conn->set_memory_response(body, sizeof(body) - 1, "text/plain");
+    return MEMORY_REQUEST;
+}
+
+//响应内容在请求内存池中生成，process_write复制到写缓冲区后随请求一起释放
+http_conn::HTTP_CODE http_conn::handle_stats(http_conn *conn, const char *)
+{
+    const int size = 512;
+    char *body = (char *)conn->scratch(size);
+    int len = snprintf(body, size,
+                       "connections:%d\nrequests:%llu\nheap_allocs:%llu\nrequests_with_allocs:%llu\n"
+                       "cache_hits:%lu\ncache_misses:%lu\nwrite_yields:%llu\nidle_evictions:%llu\nuploads:%d\nbuffers_in_use:%d\n",
+                       (int)m_user_count, alloc_counter::requests(), alloc_counter::allocs(),
+                       alloc_counter::alloc_requests(), file_cache::get_instance()->hits(),
+                       file_cache::get_instance()->misses(), m_write_yields.load(std::memory_order_relaxed),
+                       m_idle_evictions.load(std::memory_order_relaxed), (int)m_uploads,
+                       buffer_pool::get_instance()->in_use());
+    conn->set_memory_response(body, len < size ? len : size - 1, "text/plain");
+    return MEMORY_REQUEST;
+}
+
+http_conn::HTTP_CODE http_conn::do_request()
+{
+    //默认的目标文件：直接将url与网站目录拼接
+    set_real_file(m_url);
+
+    //上传文件：消息体已在临时文件中
+    std::string boundary;
+    if (m_body_fd != -1 && multipart::get_boundary(get_header("Content-Type"), boundary))
+        return do_upload();
+
+    //路由表按请求路径（不含查询字符串）精确匹配，命中时由处理函数改写目标文件或直接生成响应
+    const route *r = m_routes.find(m_url, strcspn(m_url, "?"));
+    if (r)
+    {
+        HTTP_CODE ret = r->handler(this, r->arg);
+        if (ret != FILE_REQUEST)
+            return ret;
+    }
+
+    //条件GET、Range和内容协商用到的请求头
+    m_range = get_header("Range");
+    m_if_range = get_header("If-Range");
+    m_if_none_match = get_header("If-None-Match");
+    m_if_modified_since = get_header("If-Modified-Since");
+    m_accept_encoding = get_header("Accept-Encoding");
+
+    //从文件缓存获取请求资源：命中时直接复用已打开的描述符、映射和stat信息
+    //文件不存在返回NO_RESOURCE，其他用户不可读返回FORBIDDEN_REQUEST，目录返回BAD_REQUEST
+    //不缓存的大文件只有io_uring后端和多区间响应需要映射，sendfile发送时不映射
+    bool map = m_epollfd == -1 || (m_range && strchr(m_range, ','));
+    int err = file_cache::get_instance()->acquire(m_real_file, m_file, map);
+    if (ENOENT == err)
+        return NO_RESOURCE;
+    if (EACCES == err)
+        return FORBIDDEN_REQUEST;
+    if (EISDIR == err)
+        return BAD_REQUEST;
+    //描述符耗尽、内存不足等服务器自身的问题
+    if (err)
+    {
+        LOG_ERROR("load %s failed: %s", m_real_file, strerror(err));
+        return INTERNAL_ERROR;
+    }
+    m_file_stat = m_file->st;
+
+    //选择响应内容的编码，条件GET和ETag针对选定的内容
+    negotiate_encoding();
+    //客户端缓存的文件仍然有效，只返回不带消息体的304
+    if (not_modified())
+        return NOT_MODIFIED;
+    m_range_count = parse_range();
+    if (m_range_count < 0)
+        return RANGE_NOT_SATISFIABLE;
+
+    //大文件用sendfile由内核直接从页缓存发送，单区间请求只发送区间内的部分
+    //io_uring后端（m_epollfd为-1）以内存地址提交send，使用映射
+    //sendfile通过m_file_offset指定偏移，不改变描述符的文件位置，多个连接可共用同一个描述符
+    if (m_file_stat.st_size >= SENDFILE_THRESHOLD && m_epollfd != -1 && m_range_count <= 1 && !m_encoded)
+    {
+        m_file_fd = m_file->fd;
+        m_file_offset = 0;
+        m_file_end = m_file_stat.st_size;
+        if (1 == m_range_count)
+        {
+            m_file_offset = m_ranges[0].first;
+            m_file_end = m_ranges[0].last + 1;
         }
-        //登录校验
-        else if (*(p + 1) == '2')
+        //不缓存的大文件（如视频）通常不在页缓存中，提示内核按顺序读取，发送时再逐块预读
+        m_readahead = m_file_end;
+        if (m_file_stat.st_size > file_cache::MAX_FILE)
         {
-            if (users.find(name) != users.end() && users[name] == password)
-                strcpy(m_url, "/welcome.html");
-            else
-                strcpy(m_url, "/logError.html");
+            posix_fadvise(m_file_fd, m_file_offset, m_file_end - m_file_offset, POSIX_FADV_SEQUENTIAL);
+            m_readahead = m_file_offset;
         }
+        return FILE_REQUEST;
     }
+    m_file_address = m_file->addr;
 
-    /*-----------------------------页面跳转设置（实际应该用常量或者专用用一个初始化文件来处理这些页面，否则修改会比较麻烦？）------------------------*/
-    if (*(p + 1) == '0')
+    //表示请求文件存在，且可以访问
+    return FILE_REQUEST;
+}
+int http_conn::parse_range()
+{
+    if (!m_range || m_method != GET)
+        return 0;
+    //If-Range与文件当前的ETag（强比较）或Last-Modified不一致，说明客户端已有的部分内容已过期，返回完整文件
+    if (m_if_range)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/register.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        char validator[64];
+        if ('"' == m_if_range[0])
+            get_etag(validator, sizeof(validator));
+        else
+            http_date(m_file_stat.st_mtime, validator, sizeof(validator));
+        if (strcmp(m_if_range, validator) != 0)
+            return 0;
     }
-    //如果请求资源为/1，表示跳转登录界面
-    else if (*(p + 1) == '1')
+    if (strncasecmp(m_range, "bytes=", 6) != 0)
+        return 0;
+
+    long long size = m_file_stat.st_size;
+    int count = 0;
+    const char *p = m_range + 6;
+    while (true)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/log.html");
-        //将网站目录和/log.html进行拼接，更新到m_real_file中
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        p += strspn(p, " \t");
+        long long first, last;
+        char *end;
+        //后缀区间：-n表示最后n个字节
+        if ('-' == *p && isdigit(p[1]))
+        {
+            long long n = strtoll(p + 1, &end, 10);
+            first = n < size ? size - n : 0;
+            last = size - 1;
+        }
+        //first-last或first-，last超出文件大小时截断到文件末尾
+        else if (isdigit(*p))
+        {
+            first = strtoll(p, &end, 10);
+            if (*end != '-')
+                return 0;
+            last = size - 1;
+            if (isdigit(end[1]))
+            {
+                long long value = strtoll(end + 1, &end, 10);
+                if (value < first)
+                    return 0;
+                if (value < last)
+                    last = value;
+            }
+            else
+                ++end;
+        }
+        //语法错误的Range按没有Range处理
+        else
+            return 0;
+        p = end + strspn(end, " \t");
+        if (*p != ',' && *p != '\0')
+            return 0;
 
-        free(m_url_real);
+        //首字节超出文件大小的区间不可满足，跳过
+        if (first < size && first <= last)
+        {
+            if (MAX_RANGES == count)
+                return 0;
+            m_ranges[count].first = first;
+            m_ranges[count].last = last;
+            ++count;
+        }
+        if ('\0' == *p)
+            break;
+        ++p;
     }
-    else if (*(p + 1) == '5')
+    return count ? count : -1;
+}
+void http_conn::get_etag(char *buf, int size)
+{
+    file_etag(m_file_stat, buf);
+    //后台压缩副本与原文件的stat相同，附加编码后缀区分；预压缩文件有自己的stat
+    size_t len = strlen(buf);
+    size_t enc_len = m_encoded ? strlen(m_encoding) : 0;
+    if (m_encoded && len + enc_len + 2 < (size_t)size)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/picture.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        char *p = buf + len - 1;
+        *p++ = '-';
+        memcpy(p, m_encoding, enc_len);
+        p += enc_len;
+        *p++ = '"';
+        *p = '\0';
+    }
+}
 
-        free(m_url_real);
+void http_conn::negotiate_encoding()
+{
+    if (!compressible(m_real_file))
+        return;
+    //与请求方法无关，同一文件的所有响应（包括缓存的完整响应报文）都带Vary
+    m_vary = true;
+    //Range针对原始内容，不协商压缩
+    if (m_method != GET || !m_accept_encoding || m_range)
+        return;
+
+    static const char *names[ENCODING_NUM] = {"gzip", "br"};
+    static const char *suffixes[ENCODING_NUM] = {".gz", ".br"};
+    //br压缩率更高，优先于gzip
+    static const int order[ENCODING_NUM] = {ENCODING_BR, ENCODING_GZIP};
+    bool accepted[ENCODING_NUM];
+    for (int i = 0; i < ENCODING_NUM; ++i)
+        accepted[i] = accepts_encoding(m_accept_encoding, names[i]);
+
+    //1.预压缩的同名文件：比原文件旧的视为过期，不存在的路径由文件缓存负缓存，重复查找不访问文件系统
+    char path[FILENAME_LEN + 4];
+    for (int i = 0; i < ENCODING_NUM; ++i)
+    {
+        int enc = order[i];
+        if (!accepted[enc])
+            continue;
+        snprintf(path, sizeof(path), "%s%s", m_real_file, suffixes[enc]);
+        file_entry *sibling = NULL;
+        if (file_cache::get_instance()->acquire(path, sibling) != 0)
+            continue;
+        if (sibling->st.st_mtime < m_file_stat.st_mtime)
+        {
+            file_cache::get_instance()->release(sibling);
+            continue;
+        }
+        file_cache::get_instance()->release(m_file);
+        m_file = sibling;
+        m_file_stat = sibling->st;
+        m_encoding = names[enc];
+        return;
     }
-    else if (*(p + 1) == '6')
+
+    //2.后台生成的压缩副本，尚未生成时本次返回原始内容
+    for (int i = 0; i < ENCODING_NUM; ++i)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
+        int enc = order[i];
+        if (!accepted[enc])
+            continue;
+        const std::string *encoded = file_cache::get_instance()->get_encoded(m_file, enc);
+        if (encoded)
+        {
+            m_encoded = encoded;
+            m_encoding = names[enc];
+            return;
+        }
+    }
+}
 
-        free(m_url_real);
+bool http_conn::not_modified()
+{
+    if (m_method != GET)
+        return false;
+    //同时带有两者时以If-None-Match为准
+    if (m_if_none_match)
+    {
+        char etag[64];
+        get_etag(etag, sizeof(etag));
+        return etag_match(m_if_none_match, etag);
     }
-    else if (*(p + 1) == '7')
+    if (m_if_modified_since)
     {
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/fans.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        //无法解析的日期忽略
+        if (!strptime(m_if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm))
+            return false;
+        return m_file_stat.st_mtime <= timegm(&tm);
     }
-    //如果以上均不符合，即不是登录和注册，直接将url与网站目录拼接
-    //这里的情况是welcome界面，请求服务器上的一个图片
-    else
-        strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    
-    //通过stat(系统调用)获取请求资源文件信息，成功则将信息更新到m_file_stat结构体
-    //失败返回NO_RESOURCE状态，表示资源不存在
-    if (stat(m_real_file, &m_file_stat) < 0)
-        return NO_RESOURCE;
-    //判断文件的权限，是否可读，不可读则返回FORBIDDEN_REQUEST状态
-    if (!(m_file_stat.st_mode & S_IROTH))
+    return false;
+}
+http_conn::HTTP_CODE http_conn::do_upload()
+{
+    //上传目录为网站根目录下的upload，不存在时不接受上传
+    char dir[FILENAME_LEN];
+    snprintf(dir, sizeof(dir), "%s/upload", doc_root);
+    struct stat st;
+    if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
         return FORBIDDEN_REQUEST;
-    //判断文件类型，如果是目录，则返回BAD_REQUEST，表示请求报文有误
-    if (S_ISDIR(m_file_stat.st_mode))
+    std::string boundary;
+    multipart::get_boundary(get_header("Content-Type"), boundary);
+    int count = multipart::save_files(m_body_fd, m_content_length, boundary, dir);
+    if (-1 == count)
         return BAD_REQUEST;
-
-    //以只读方式获取文件描述符，通过mmap将该文件映射到内存中
-    int fd = open(m_real_file, O_RDONLY);
-    //为了提高访问速度，通过mmap进行映射，将普通文件映射到内存逻辑地址
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    
-    //避免文件描述符的浪费和占用
-    close(fd);
-    
-    //表示请求文件存在，且可以访问
-    return FILE_REQUEST;
+    if (count < 0)
+        return INTERNAL_ERROR;
+    LOG_INFO("upload %d file(s) to %s", count, dir);
+    m_upload_count = count;
+    return UPLOAD_REQUEST;
 }
 //释放映射文件的内存空间
 void http_conn::unmap()
 {
-    if (m_file_address)
+    if (m_file)
     {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+        file_cache::get_instance()->release(m_file);
+        m_file = NULL;
     }
+    for (int i = 0; i < m_part_count; ++i)
+        file_cache::get_instance()->release(m_parts[i].file);
+    m_part_count = 0;
+    m_file_address = 0;
+    m_file_fd = -1;
 }
 //响应报文写入函数，写线程从请求队列中取出m_write_buf，并写入通信socket
-bool http_conn::write()
+bool http_conn::write(WRITE_END *end)
 {
-    int temp = 0;
-    //若需要发送的数据字节数为0，则立刻重置连接
-    //表示响应报文为空，一般不会出现这种情况
-    if (bytes_to_send == 0)
-    {
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        init();
-        return true;
-    }
+    ssize_t temp = 0;
+    if (end)
+        *end = WRITE_AGAIN;
+    //本轮写事件已发送的字节数
+    long long sent = 0;
     //写入socket
-    while (1)
+    while (bytes_to_send > 0)
     {
-        //通过writev函数循环发送响应报文数据给浏览器端
-        //返回发送的字节数
-        temp = writev(m_sockfd, m_iv, m_iv_count);
-        //若writev单次发送不成功，判断是否是写缓冲区满了
+        //本轮配额已用完：让出事件循环（或工作线程），重新注册写事件
+        //重新注册的连接排在epoll就绪队列末尾，其他就绪连接先得到发送机会，形成轮转
+        if (m_write_quota > 0 && sent >= m_write_quota)
+        {
+            m_write_yields.fetch_add(1, std::memory_order_relaxed);
+            update_send_deadline();
+            modfd(m_epollfd, m_sockfd, this, EPOLLOUT, m_TRIGMode);
+            return true;
+        }
+        //sendfile模式下文件内容尚未发送的字节数，文件内容排在所有iovec之后
+        off_t file_left = (m_file_fd != -1) ? m_file_end - m_file_offset : 0;
+        bool from_iov = bytes_to_send > file_left;
+        if (from_iov)
+        {
+            //通过sendmsg一次发送排队的全部响应头部和内容
+            //之后还有sendfile的文件内容时带MSG_MORE，内核等文件内容到达后合并成满长度的TCP报文
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_iv;
+            msg.msg_iovlen = m_iv_count;
+            //超过本轮剩余的配额时只发送配额内的部分，截短的iovec放在栈上，m_iv仍按实际发送的字节数偏移
+            struct iovec iv[2 * MAX_PARTS];
+            if (m_write_quota > 0 && bytes_to_send - file_left > m_write_quota - sent)
+            {
+                long long left = m_write_quota - sent;
+                int count = 0;
+                for (int i = 0; i < m_iv_count && left > 0; ++i)
+                {
+                    iv[count] = m_iv[i];
+                    if ((long long)iv[count].iov_len > left)
+                        iv[count].iov_len = left;
+                    left -= iv[count].iov_len;
+                    ++count;
+                }
+                msg.msg_iov = iv;
+                msg.msg_iovlen = count;
+            }
+            temp = sendmsg(m_sockfd, &msg, file_left ? MSG_MORE : 0);
+        }
+        else
+        {
+            //文件内容由sendfile从页缓存直接发送，不经过用户态，每次最多发送一块
+            off_t chunk = file_left < SENDFILE_CHUNK ? file_left : SENDFILE_CHUNK;
+            //不超过本轮剩余的配额
+            if (m_write_quota > 0 && chunk > m_write_quota - sent)
+                chunk = m_write_quota - sent;
+            //始终提前一块提示内核预读，磁盘读取与网络发送重叠进行
+            if (m_readahead < m_file_end && m_readahead < m_file_offset + 2 * chunk)
+            {
+                off_t ahead = m_file_end - m_readahead < SENDFILE_CHUNK ? m_file_end - m_readahead : SENDFILE_CHUNK;
+                posix_fadvise(m_file_fd, m_readahead, ahead, POSIX_FADV_WILLNEED);
+                m_readahead += ahead;
+            }
+            temp = sendfile(m_sockfd, m_file_fd, &m_file_offset, chunk);
+        }
+        //若单次发送不成功，判断是否是写缓冲区满了
         if (temp < 0)
         {
             //若eagain则说明写缓冲区满
-            //更新iovec结构体的指针和长度，并注册写事件，等待下一次写事件触发
+            //iovec结构体的指针和长度已随发送更新，注册写事件，等待下一次写事件触发
             if (errno == EAGAIN)
             {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+                update_send_deadline();
+                modfd(m_epollfd, m_sockfd, this, EPOLLOUT, m_TRIGMode);
                 return true;
             }
             unmap();
             return false;
         }
+        //文件在发送过程中被截短
+        if (temp == 0)
+        {
+            unmap();
+            return false;
+        }
         //更新已发送字节和待发送字节
+        sent += temp;
         bytes_have_send += temp;
         bytes_to_send -= temp;
-        //第一个iovec头部信息的数据已发送完，需要准备好发送第二个iovec数据，需偏移文件指针
-        if (bytes_have_send >= m_iv[0].iov_len)
-        {
-            //不再继续发送头部信息
-            m_iv[0].iov_len = 0;
-            //偏移文件iovec的指针
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        //继续发送第一个iovec头部信息的数据
-        else
+        //跳过已发送完的iovec，并偏移部分发送的iovec
+        for (int i = 0; from_iov && i < m_iv_count && temp > 0; ++i)
         {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+            size_t len = m_iv[i].iov_len < (size_t)temp ? m_iv[i].iov_len : (size_t)temp;
+            m_iv[i].iov_base = (char *)m_iv[i].iov_base + len;
+            m_iv[i].iov_len -= len;
+            temp -= len;
         }
+    }
 
-        //判断响应报文整体是否发送成功
-        if (bytes_to_send <= 0)
-        {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-            //长连接
-            if (m_linger)
-            {
-                //重置http类实例，注册读事件
-                init();
-                //返回true表示不关闭连接
-                return true;
-            }
-            //短连接
-            else
-            {
-                //返回false表示关闭连接
-                return false;
-            }
-        }
+    //响应报文整体发送成功
+    bool keep = send_complete();
+    //长连接：读缓冲区中还有流水线请求数据时由调用方继续处理，否则注册读事件等待下一个请求
+    if (keep && has_pending_request())
+    {
+        if (end)
+            *end = WRITE_PIPELINE;
+    }
+    else if (keep)
+    {
+        if (end)
+            *end = WRITE_IDLE;
+        modfd(m_epollfd, m_sockfd, this, EPOLLIN, m_TRIGMode);
     }
+    return keep;
 }
-//根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
-//下面的响应报文写入函数均通过add_response更新m_write_idx指针和缓冲区m_write_buf中的内容
-bool http_conn::add_response(const char *format, ...)
+//响应报文已全部发送，write()和io_uring后端共用
+bool http_conn::send_complete()
 {
-    //如果写入内容超出m_write_buf大小则报错
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
-        return false;
-    //定义可变参数列表
-    va_list arg_list;
-    //将变量arg_list初始化为传入参数
-    va_start(arg_list, format);
-    //将数据format从可变参数列表写入缓冲区，返回写入数据的长度
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    //若写入数据长度超过缓冲区剩余空间，则报错
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx))
-    {
-        va_end(arg_list);
+    unmap();
+    //短连接：连接即将关闭，先归还缓冲区，返回false表示关闭连接
+    if (!m_keep_alive)
+    {
+        free_buffers();
+        end_body();
         return false;
     }
-    //更新写缓冲区已写内容指针的位置
-    m_write_idx += len;
-    //清空可变参数列表
-    va_end(arg_list);
-    //写日志
-    LOG_INFO("request:%s", m_write_buf);
+    //长连接：解析状态已在next_request中重置，只需重置写状态
+    //读缓冲区中没有剩余的流水线请求数据时一并归还，空闲长连接不占用缓冲区
+    m_write_idx = 0;
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_iv_count = 0;
+    m_keep_alive = false;
+    free_write_buf();
+    if (0 == m_read_idx)
+        free_read_buf();
+    //读缓冲区中还有流水线请求时直接开始接收其头部，否则进入空闲
+    set_phase(m_read_idx > 0 ? PHASE_HEADER : PHASE_IDLE);
+    return true;
+}
+
+void http_conn::wake()
+{
+    if (PHASE_IDLE == m_phase)
+        set_phase(PHASE_HEADER);
+}
+
+void http_conn::add_sent(long long bytes)
+{
+    bytes_have_send += bytes;
+    update_send_deadline();
+}
+
+void http_conn::set_phase(PHASE phase)
+{
+    m_phase = phase;
+    long long now = time_ms();
+    long long timeout = 0;
+    switch (phase)
+    {
+    case PHASE_HEADER:
+        timeout = m_header_timeout;
+        break;
+    case PHASE_BODY:
+        timeout = m_body_timeout;
+        break;
+    case PHASE_WRITE:
+        m_write_start = now;
+        timeout = SEND_GRACE_MS;
+        break;
+    case PHASE_IDLE:
+        timeout = m_idle_timeout;
+        break;
+    }
+    m_timer_data.deadline.store(now + timeout, std::memory_order_relaxed);
+}
 
+void http_conn::update_send_deadline()
+{
+    long long deadline;
+    //没有最低速率要求时，只要求每个宽限时间内有发送进展
+    if (m_min_send_rate <= 0)
+        deadline = time_ms() + SEND_GRACE_MS;
+    else
+        deadline = m_write_start + SEND_GRACE_MS + bytes_have_send * 1000 / m_min_send_rate;
+    m_timer_data.deadline.store(deadline, std::memory_order_relaxed);
+}
+//根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
+//下面的响应报文写入函数均通过add_bytes更新m_write_idx指针和缓冲区m_write_buf中的内容
+bool http_conn::add_bytes(const char *data, int len)
+{
+    //首次写入时借用写缓冲区，剩余空间不足时换用更大一级的缓冲区，已达上限则报错
+    while (m_write_idx + len > m_write_size - 1)
+    {
+        if (!grow_write_buf())
+            return false;
+    }
+    memcpy(m_write_buf + m_write_idx, data, len);
+    m_write_idx += len;
     return true;
 }
-//添加状态行
+bool http_conn::add_number(long long value)
+{
+    char buf[20];
+    return add_bytes(buf, format_number((unsigned long long)value, buf));
+}
+//添加状态行和Date头部
 bool http_conn::add_status_line(int status, const char *title)
 {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    return add_literal("HTTP/1.1 ") && add_number(status) && add_literal(" ") && add_content(title) &&
+           add_literal("\r\n") && add_bytes(date_cache::get_instance()->line(), date_cache::LINE_LEN);
 }
 //添加消息报头，具体地：添加响应报文长度、连接状态和空行
-bool http_conn::add_headers(int content_len)
+bool http_conn::add_headers(long long content_len)
 {
     return add_content_length(content_len) && add_linger() &&
            add_blank_line();
 }
 //添加响应报文长度
-bool http_conn::add_content_length(int content_len)
+bool http_conn::add_content_length(long long content_len)
 {
-    return add_response("Content-Length:%d\r\n", content_len);
+    return add_literal("Content-Length:") && add_number(content_len) && add_literal("\r\n");
 }
 //添加文本类型
 bool http_conn::add_content_type()
 {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    return add_literal("Content-Type:text/html\r\n");
+}
+//添加区间响应的Content-Range
+bool http_conn::add_content_range(long long first, long long last)
+{
+    return add_literal("Content-Range:bytes ") && add_number(first) && add_literal("-") && add_number(last) &&
+           add_literal("/") && add_number(m_file_stat.st_size) && add_literal("\r\n");
+}
+//添加文件响应的区间支持声明和校验信息，客户端以ETag和Last-Modified发起条件GET和If-Range
+//Cache-Control取最长匹配的路径前缀对应的策略
+bool http_conn::add_file_headers()
+{
+    char etag[64], date[date_cache::DATE_LEN];
+    get_etag(etag, sizeof(etag));
+    date_cache::format(m_file_stat.st_mtime, date);
+    if (!add_literal("Accept-Ranges:bytes\r\nETag:") || !add_content(etag) ||
+        !add_literal("\r\nLast-Modified:") || !add_bytes(date, sizeof(date)) || !add_literal("\r\n"))
+        return false;
+    if (m_encoding && !(add_literal("Content-Encoding:") && add_content(m_encoding) && add_literal("\r\n")))
+        return false;
+    if (m_vary && !add_literal("Vary:Accept-Encoding\r\n"))
+        return false;
+    const char *path = m_real_file + strlen(doc_root);
+    for (size_t i = 0; i < m_cache_control.size(); ++i)
+    {
+        const string &prefix = m_cache_control[i].first;
+        const string &value = m_cache_control[i].second;
+        if (strncmp(path, prefix.c_str(), prefix.size()) == 0)
+            return add_literal("Cache-Control:") && add_bytes(value.data(), value.size()) && add_literal("\r\n");
+    }
+    return true;
 }
 //添加连接状态，通知浏览器是保持连接还是关闭
 bool http_conn::add_linger()
 {
-    return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
+    if (m_linger)
+        return add_literal("Connection:keep-alive\r\n");
+    return add_literal("Connection:close\r\n");
 }
 //添加空行
 bool http_conn::add_blank_line()
 {
-    return add_response("%s", "\r\n");
+    return add_literal("\r\n");
 }
 //添加响应正文
 bool http_conn::add_content(const char *content)
 {
-    return add_response("%s", content);
+    return add_bytes(content, strlen(content));
 }
 
 //向m_write_buf中写入响应报文
 bool http_conn::process_write(HTTP_CODE ret)
 {
+    //本次响应的头部从m_write_buf的当前位置开始写入，排在之前的流水线响应之后
+    int head_start = m_write_idx;
     switch (ret)
     {
     case INTERNAL_ERROR:
@@ -760,6 +1637,56 @@ bool http_conn::process_write(HTTP_CODE ret)
             return false;
         break;
     }
+    case PAYLOAD_TOO_LARGE:
+    {
+        add_status_line(413, error_413_title);
+        add_headers(strlen(error_413_form));
+        if (!add_content(error_413_form))
+            return false;
+        break;
+    }
+    case UPLOAD_REQUEST:
+    {
+        static const char prefix[] = "<html><body>";
+        static const char suffix[] = " file(s) uploaded</body></html>";
+        char body[128];
+        int len = sizeof(prefix) - 1;
+        memcpy(body, prefix, len);
+        len += format_number(m_upload_count, body + len);
+        memcpy(body + len, suffix, sizeof(suffix));
+        len += sizeof(suffix) - 1;
+        add_status_line(200, ok_200_title);
+        add_headers(len);
+        if (!add_content(body))
+            return false;
+        break;
+    }
+    case MEMORY_REQUEST:
+    {
+        if (!add_status_line(200, ok_200_title) || !add_literal("Content-Type:") || !add_content(m_memory_type) ||
+            !add_literal("\r\n") || !add_headers(m_memory_len) || !add_bytes(m_memory_body, m_memory_len))
+            return false;
+        break;
+    }
+    case NOT_MODIFIED:
+    {
+        //304不带消息体，也不发送Content-Length
+        if (!add_status_line(304, not_modified_304_title) || !add_file_headers() ||
+            !add_linger() || !add_blank_line())
+            return false;
+        break;
+    }
+    case RANGE_NOT_SATISFIABLE:
+    {
+        add_status_line(416, error_416_title);
+        add_literal("Content-Range:bytes */");
+        add_number(m_file_stat.st_size);
+        add_literal("\r\n");
+        add_headers(strlen(error_416_form));
+        if (!add_content(error_416_form))
+            return false;
+        break;
+    }
     case FORBIDDEN_REQUEST:
     {
         add_status_line(403, error_403_title);
@@ -770,23 +1697,63 @@ bool http_conn::process_write(HTTP_CODE ret)
     }
     case FILE_REQUEST:
     {
-        //注意：有两个iovec
-        //m_iv[0]指向m_write_buf，是响应报文头部的内容（状态行/消息报头等）
-        //m_iv[1]指向文件地址m_file_address，是http请求资源(文件)的数据
-        //iovec指针成员有两个：
-        //iov_base指向一个缓冲区，这个缓冲区是存放的是writev将要发送的数据
-        //iov_len表示实际写入的长度
+        //每个响应最多占两个iovec：
+        //一个指向m_write_buf，是响应报文头部的内容（状态行/消息报头等）
+        //一个指向文件地址m_file_address，是http请求资源(文件)的数据
+        //多区间：每个区间占一个片段，响应头部随第一个区间发送
+        if (m_range_count > 1)
+            return add_byteranges(head_start);
+        //单区间：206，内容为映射中的区间或由sendfile发送的区间
+        if (1 == m_range_count)
+        {
+            const byte_range &range = m_ranges[0];
+            long long len = range.last - range.first + 1;
+            if (!add_status_line(206, ok_206_title) || !add_content_range(range.first, range.last) ||
+                !add_file_headers() || !add_headers(len))
+                return false;
+            if (m_file_fd != -1)
+                return queue_response(head_start, NULL, 0);
+            return queue_response(head_start, m_file_address + range.first, len);
+        }
+        //后台生成的压缩副本：内容在文件缓存条目中，随条目引用一起保持有效
+        if (m_encoded)
+        {
+            if (!add_status_line(200, ok_200_title) || !add_file_headers() || !add_headers(m_encoded->size()))
+                return false;
+            return queue_response(head_start, m_encoded->data(), m_encoded->size());
+        }
+        //小文件：使用文件缓存中组装好的响应报文，未命中时组装一次并保存
+        //缓存的报文从Date之后的头部开始，状态行和当前的Date每次写入m_write_buf
+        //预压缩文件也可以被直接请求，其完整响应不带Content-Encoding，因此只用于原始内容
+        if (m_file_address && m_file_stat.st_size <= file_cache::MAX_RESPONSE_FILE && !m_encoding)
+        {
+            if (!add_status_line(200, ok_200_title))
+                return false;
+            const std::string *response = file_cache::get_instance()->get_response(m_file, m_linger);
+            if (!response)
+            {
+                int blob_start = m_write_idx;
+                if (!add_file_headers() || !add_headers(m_file_stat.st_size))
+                    return false;
+                std::string blob(m_write_buf + blob_start, m_write_idx - blob_start);
+                blob.append(m_file_address, m_file_stat.st_size);
+                response = file_cache::get_instance()->set_response(m_file, m_linger, blob);
+                m_write_idx = blob_start;
+            }
+            return queue_response(head_start, response->data(), response->size());
+        }
         add_status_line(200, ok_200_title);
+        add_file_headers();
+        //sendfile模式：只有头部进入iovec，文件内容在write中由sendfile发送
+        if (m_file_fd != -1)
+        {
+            add_headers(m_file_stat.st_size);
+            return queue_response(head_start, NULL, 0);
+        }
         if (m_file_stat.st_size != 0)
         {
             add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
-            return true;
+            return queue_response(head_start, m_file_address, m_file_stat.st_size);
         }
         else
         {
@@ -795,36 +1762,182 @@ bool http_conn::process_write(HTTP_CODE ret)
             if (!add_content(ok_string))
                 return false;
         }
+        break;
     }
     default:
         return false;
     }
-    //执行非FILE_REQUEST情况下的写入操作
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    //非FILE_REQUEST情况下响应报文全部在m_write_buf中
+    return queue_response(head_start, NULL, 0);
+}
+
+bool http_conn::add_byteranges(int head_start)
+{
+    //每个区间之前是分隔行和Content-Range头部，最后是结束分隔行
+    static const char part_head[] = "\r\n--";
+    static const char range_head[] = "Content-Range:bytes ";
+    int boundary_len = strlen(byteranges_boundary);
+    long long size = m_file_stat.st_size;
+    //先计算消息体总长度：各区间的分隔行、头部和内容，以及结束分隔行
+    long long body_len = (sizeof(part_head) - 1) + boundary_len + 4;
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        long long first = m_ranges[i].first, last = m_ranges[i].last;
+        body_len += (sizeof(part_head) - 1) + boundary_len + 2 + (sizeof(range_head) - 1) +
+                    number_len(first) + 1 + number_len(last) + 1 + number_len(size) + 4;
+        body_len += last - first + 1;
+    }
+    if (!add_status_line(206, ok_206_title) ||
+        !add_literal("Content-Type:multipart/byteranges; boundary=") ||
+        !add_bytes(byteranges_boundary, boundary_len) || !add_literal("\r\n") ||
+        !add_file_headers() || !add_headers(body_len))
+        return false;
+
+    //queue_response会把文件引用转交给第一个片段并清空m_file_address
+    const char *addr = m_file_address;
+    for (int i = 0; i < m_range_count; ++i)
+    {
+        long long first = m_ranges[i].first, last = m_ranges[i].last;
+        if (!add_literal(part_head) || !add_bytes(byteranges_boundary, boundary_len) || !add_literal("\r\n") ||
+            !add_content_range(first, last) || !add_literal("\r\n") ||
+            !queue_response(head_start, addr + first, last - first + 1))
+            return false;
+        head_start = m_write_idx;
+    }
+    if (!add_literal(part_head) || !add_bytes(byteranges_boundary, boundary_len) || !add_literal("--\r\n"))
+        return false;
+    return queue_response(head_start, NULL, 0);
+}
+
+bool http_conn::queue_response(int head_start, const char *body, long long body_len)
+{
+    response_part &part = m_parts[m_part_count++];
+    part.head_start = head_start;
+    part.head_len = m_write_idx - head_start;
+    part.body = body;
+    part.body_len = body_len;
+    //文件缓存条目的引用转交给队列，直到响应发送完毕
+    part.file = m_file;
+    m_file = NULL;
+    m_file_address = 0;
     return true;
 }
 
+//写缓冲区在生成响应的过程中可能扩大，所有响应生成完毕后再换算头部地址
+void http_conn::build_iov()
+{
+    m_iv_count = 0;
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    for (int i = 0; i < m_part_count; ++i)
+    {
+        if (m_parts[i].head_len > 0)
+        {
+            m_iv[m_iv_count].iov_base = m_write_buf + m_parts[i].head_start;
+            m_iv[m_iv_count].iov_len = m_parts[i].head_len;
+            m_iv_count++;
+        }
+        if (m_parts[i].body_len > 0)
+        {
+            m_iv[m_iv_count].iov_base = (char *)m_parts[i].body;
+            m_iv[m_iv_count].iov_len = m_parts[i].body_len;
+            m_iv_count++;
+        }
+        bytes_to_send += m_parts[i].head_len + m_parts[i].body_len;
+    }
+    //sendfile的文件内容排在最后
+    if (m_file_fd != -1)
+        bytes_to_send += m_file_end - m_file_offset;
+}
+
+void http_conn::next_request()
+{
+    //当前请求的结束位置，带消息体的请求还包括消息体
+    //流式接收的消息体不在读缓冲区中
+    int end = m_checked_idx;
+    if (m_check_state == CHECK_STATE_CONTENT && -1 == m_body_fd)
+    {
+        end += m_content_length;
+        //恢复parse_content截断消息体时覆盖的字节
+        m_read_buf[end] = m_content_end;
+    }
+    m_read_idx -= end;
+    memmove(m_read_buf, m_read_buf + end, m_read_idx);
+    m_read_buf[m_read_idx] = '\0';
+
+    end_body();
+    m_check_state = CHECK_STATE_REQUESTLINE;
+    m_linger = false;
+    m_method = GET;
+    m_url = 0;
+    m_version = 0;
+    m_content_length = 0;
+    m_host = 0;
+    m_header_count = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_if_none_match = 0;
+    m_if_modified_since = 0;
+    m_accept_encoding = 0;
+    m_encoding = NULL;
+    m_encoded = NULL;
+    m_vary = false;
+    m_range_count = 0;
+    m_start_line = 0;
+    m_checked_idx = 0;
+    cgi = 0;
+    memset(m_real_file, '\0', FILENAME_LEN);
+}
+
 //http处理函数，内部调用process_read和prosess_write
-void http_conn::process()
+bool http_conn::process()
 {
-    //如果成功解析请求报文，read_ret是do_request返回的状态值
-    HTTP_CODE read_ret = process_read();
-    //NO_REQUEST表示还没有完成请求报文解析，需要继续接收请求数据
-    if (read_ret == NO_REQUEST)
+    //流水线：依次解析读缓冲区中的完整请求，不再重新读取
+    //剩余的片段位置不足以容纳一个多区间响应时，之后的请求等本批响应发送完毕再处理
+    while (m_part_count + MAX_RANGES + 1 <= MAX_PARTS)
     {
-        //将读事件重置为EPOLLONESHOT，否则后续无法再次触发
-        modfd(m_epollfd, m_sockfd, EPOLLIN, m_TRIGMode);
-        return;
+        //记录处理本请求前当前线程的堆分配次数
+        unsigned long allocs = alloc_counter::thread_count();
+        //如果成功解析请求报文，read_ret是do_request返回的状态值
+        HTTP_CODE read_ret = process_read();
+        //NO_REQUEST表示剩余数据不是完整的请求，需要继续接收请求数据
+        if (read_ret == NO_REQUEST)
+        {
+            arena::local()->reset();
+            break;
+        }
+        //旧进程排空连接期间，本次响应后关闭连接，客户端的下一个请求由新进程处理
+        //达到单个连接的请求数上限，或连接数接近上限时，也在本次响应后关闭，把槽位让给新客户端
+        ++m_request_count;
+        if (m_draining || (m_max_requests > 0 && m_request_count >= m_max_requests) || m_user_count >= m_busy_conns)
+            m_linger = false;
+        //调用process_write生成响应报文并排队
+        //生成响应失败，由事件循环根据完成通知关闭连接
+        bool ok = process_write(read_ret);
+        //响应报文已生成，本请求的临时内存不再使用
+        arena::local()->reset();
+        alloc_counter::record_request(alloc_counter::thread_count() - allocs);
+        if (!ok)
+            return false;
+        m_keep_alive = m_linger;
+        //短连接：发送完本批响应即关闭，之后的请求不再处理
+        if (!m_linger)
+            break;
+        next_request();
+        //sendfile的文件内容无法与之后的响应合并发送，只能排在本批最后
+        if (m_file_fd != -1)
+            break;
     }
-    //调用process_write完成报文响应
-    bool write_ret = process_write(read_ret);
-    if (!write_ret)
+    //没有完整的请求，将读事件重置为EPOLLONESHOT，否则后续无法再次触发
+    if (0 == m_part_count)
     {
-        close_conn();
+        modfd(m_epollfd, m_sockfd, this, EPOLLIN, m_TRIGMode);
+        return true;
     }
+    build_iov();
+    //开始发送本批响应
+    set_phase(PHASE_WRITE);
     //注册并监听写事件，将写事件重置为EPOLLONESHOT，否则后续无法再次触发
-    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_TRIGMode);
+    modfd(m_epollfd, m_sockfd, this, EPOLLOUT, m_TRIGMode);
+    return true;
 }
@@ -15,25 +15,60 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <stdarg.h>
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
 #include <map>
+#include <vector>
+#include <atomic>
 
 #include "../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
 #include "../timer/lst_timer.h"
 #include "../log/log.h"
+#include "../threadpool/completion_queue.h"
+#include "../buffer/buffer_pool.h"
+#include "../buffer/arena.h"
+#include "../buffer/alloc_counter.h"
+#include "../cache/file_cache.h"
+#include "http_scanner.h"
+#include "multipart.h"
+#include "date_cache.h"
+#include "route_table.h"
 
 class http_conn{
 public:
     //设置读取文件的名称m_real_file大小
     static const int FILENAME_LEN = 200;
-    //设置读缓冲区m_read_buf大小
+    //读缓冲区m_read_buf初始大小，请求较大时逐级扩大到MAX_READ_BUFFER_SIZE
     static const int READ_BUFFER_SIZE = 2048;
-    //设置写缓冲区m_write_buf大小
+    static const int MAX_READ_BUFFER_SIZE = 65536;
+    //写缓冲区m_write_buf初始大小，响应头部较大时逐级扩大
     static const int WRITE_BUFFER_SIZE = 1024;
+    //不小于该大小的文件用sendfile发送，较小的文件仍用mmap + writev与头部一次发出
+    static const int SENDFILE_THRESHOLD = 64 * 1024;
+    //一次处理的流水线请求数上限，超出的请求在本批响应发送完毕后继续处理
+    static const int MAX_PIPELINE = 16;
+    //Range请求最多响应的区间数，超出时忽略Range返回完整文件，避免重叠区间放大响应
+    static const int MAX_RANGES = 8;
+    //待发送响应片段数上限：一个多区间响应占MAX_RANGES + 1个片段
+    static const int MAX_PARTS = MAX_PIPELINE + MAX_RANGES;
+    //sendfile每次最多发送的字节数，未缓存的大文件每发送一块前预读下一块
+    static const int SENDFILE_CHUNK = 1 << 20;
+    //头部索引最多记录的请求头个数，超出的请求头不记录
+    static const int MAX_HEADERS = 32;
+    //超过该长度的消息体（以及所有multipart/form-data消息体）不进入读缓冲区，流式写入临时文件
+    static const int BODY_BUFFER_LIMIT = 8192;
+    //流式接收消息体时每次splice的字节数上限（管道默认容量）
+    static const int BODY_CHUNK = 65536;
+    //同时流式接收消息体的连接数上限，超出时响应500，使上传占用的描述符数有界
+    static const int MAX_UPLOADS = 64;
+    //每个上传最多占用的描述符数：临时文件、splice管道两端以及保存时打开的目标文件
+    static const int UPLOAD_FDS = 4;
+    //开始发送响应后的宽限时间（毫秒），之后要求平均发送速率不低于m_min_send_rate
+    static const int SEND_GRACE_MS = 10000;
     //报文的请求方法，本项目只用到GET和POST
     enum METHOD{
         GET = 0,
@@ -60,9 +95,29 @@ public:
         NO_RESOURCE,        //没有资源
         FORBIDDEN_REQUEST,  //拒绝访问
         FILE_REQUEST,       //表示请求文件存在，且可以访问
+        RANGE_NOT_SATISFIABLE,  //Range中的区间均超出文件大小
+        NOT_MODIFIED,       //条件请求：客户端缓存的文件仍然有效
+        PAYLOAD_TOO_LARGE,  //消息体超过长度上限
+        UPLOAD_REQUEST,     //上传的文件已保存
+        MEMORY_REQUEST,     //路由处理函数已生成内存中的响应内容，不访问文件系统
         INTERNAL_ERROR,     //服务器内部错误，该结果在主状态机逻辑switch的default下，一般不会触发
         CLOSED_CONNECTION   //关闭连接
     };
+    //路由处理函数：arg为注册时的参数
+    //返回FILE_REQUEST表示继续按m_real_file中的静态文件处理，其他结果直接作为请求的处理结果
+    typedef HTTP_CODE (*route_handler)(http_conn *conn, const char *arg);
+    struct route
+    {
+        route_handler handler;
+        const char *arg;
+    };
+    //连接所处的阶段，每个阶段有各自的截止时间
+    enum PHASE{
+        PHASE_HEADER = 0,   //接收请求行和头部：截止时间从阶段开始时固定，不随零散的数据推迟
+        PHASE_BODY,         //接收消息体：截止时间从头部接收完毕时固定
+        PHASE_WRITE,        //发送响应：按最低发送速率随已发送的字节数推迟
+        PHASE_IDLE          //长连接空闲，等待下一个请求
+    };
     //从状态机的状态
     //LINE_OK：读取到回车和换行字符
     //LINE_BAD：回车和换行字符单独出现在HTTP请求中
@@ -74,28 +129,95 @@ public:
     };
 
 public:
-    http_conn() {}
+    http_conn() : m_cq(NULL), m_serial(0), m_read_buf(NULL), m_read_size(0),
+                  m_write_buf(NULL), m_write_size(0), m_file_address(NULL), m_file(NULL), m_file_fd(-1), m_range_count(0), m_part_count(0),
+                  m_body_fd(-1) {
+        m_pipe[0] = m_pipe[1] = -1;
+    }
     ~http_conn() {}
 
 public:
     //初始化套接字地址，函数内部会调用私有方法init
-    void init(int sockfd, const sockaddr_in &addr, char *root, int TRIGMode, int close_log, string user, string passwd, string sqlname);
+    //epollfd为连接所属Reactor的内核事件表
+    void init(int sockfd, const sockaddr_in &addr, int epollfd, char *root, int TRIGMode, int close_log, string user, string passwd, string sqlname);
     //关闭http连接
     void close_conn(bool real_close = true);
-    //http处理函数，内部调用process_read和prosess_write
-    void process();
+    //连接关闭时归还读写缓冲区、文件缓存引用和上传占用的临时文件与管道，由release_conn在归还连接对象前调用
+    void release_resources();
+    //http处理函数，内部调用process_read和prosess_write，返回false表示需要关闭连接
+    //读缓冲区中的多个流水线请求依次处理，响应按顺序排队后一次发送
+    bool process();
     //请求报文读取函数，一次性读取浏览器发来的全部数据
     bool read_once();
-    //响应报文写入函数
-    bool write();
+    //write()结束时连接的去向，在重新注册事件之前确定
+    //重新注册事件后连接可能已被其它工作线程处理，调用方不能再读取连接的状态
+    enum WRITE_END
+    {
+        WRITE_AGAIN = 0,    //未发送完，已重新注册写事件
+        WRITE_IDLE,         //发送完毕，作为空闲长连接注册了读事件
+        WRITE_PIPELINE      //发送完毕，读缓冲区中还有流水线请求，未注册事件，由调用方继续处理
+    };
+    //响应报文写入函数，每轮最多发送m_write_quota字节，未发送完时重新注册写事件等待下一轮
+    bool write(WRITE_END *end = NULL);
+    //长连接的响应发送完毕后，读缓冲区中是否还有未处理的流水线请求数据，有则由调用方继续调用process
+    //响应尚未发送完（write因发送缓冲区满而返回）时为false，避免重复处理正在响应的请求
+    bool has_pending_request(){
+        return 0 == bytes_to_send && m_read_idx > 0;
+    }
+    //io_uring后端：由事件循环把内核已接收的数据追加到读缓冲区
+    //返回追加的字节数，读缓冲区放不下的部分由调用方暂存；写入消息体临时文件失败返回-1
+    int append_read(const char *data, int len);
+    //io_uring后端：记录部分发送的字节数，按最低发送速率推迟截止时间
+    void add_sent(long long bytes);
+    //长连接空闲期间有新数据到达，开始接收下一个请求的头部
+    void wake();
+    //是否为空闲的长连接（响应已发送完毕，等待下一个请求），只能由拥有该连接的线程调用（如io_uring事件循环）
+    bool idle() const
+    {
+        return PHASE_IDLE == m_phase;
+    }
+    //io_uring后端：是否已生成待发送的响应报文
+    bool has_response(){
+        return bytes_to_send > 0;
+    }
+    //io_uring后端：获取待发送的iovec
+    struct iovec *get_iov(int &count){
+        count = m_iv_count;
+        return m_iv;
+    }
+    //io_uring后端：响应报文已由事件循环发送完毕，长连接重置后返回true，短连接返回false
+    bool send_complete();
     //获取套接字
     sockaddr_in *get_address(){
         return &m_address;
     }
-    //同步线程初始化数据库读取表
-    void initmysql_result(connection_pool *connPool);
-    int timer_flag;     //超时标志
-    int improv;         //
+    //同步线程初始化数据库读取表，用户表为所有连接共享，因此为静态函数
+    static void initmysql_result(connection_pool *connPool, int close_log);
+    //解析按路径前缀配置的Cache-Control策略，格式为分号分隔的"路径前缀=取值"，所有连接共享
+    static void init_cache_control(const string &spec);
+    //注册内置的路由：页面跳转、登录注册校验和健康检查，须在启动事件循环之前调用
+    static void init_routes();
+    //注册路由：path为精确匹配的请求路径（不含查询字符串），arg须在整个运行期间有效
+    static void add_route(const char *path, route_handler handler, const char *arg = NULL);
+    //供路由处理函数使用：改写目标文件为网站根目录下的url
+    void set_real_file(const char *url);
+    //供路由处理函数使用：从当前线程的请求内存池分配临时内存，本请求的响应报文生成后失效
+    void *scratch(size_t size){
+        return arena::local()->alloc(size);
+    }
+    //供路由处理函数使用：设置内存中的响应内容，之后返回MEMORY_REQUEST，body在本次process期间须有效
+    void set_memory_response(const char *body, int len, const char *content_type);
+    //获取当前连接的序号，每次init分配新连接时递增
+    unsigned int get_serial(){
+        return m_serial;
+    }
+    //获取连接所属的内核事件表，io_uring后端为-1
+    int get_epollfd(){
+        return m_epollfd;
+    }
+    //按名称（不区分大小写）查找当前请求的请求头，返回以'\0'结尾的取值，不存在返回NULL
+    //头部解析完毕后到响应生成完毕前有效，同名请求头返回第一个
+    const char *get_header(const char *name);
 
 
 private:
@@ -116,6 +238,37 @@ private:
 
     //生成响应报文
     HTTP_CODE do_request();
+    //保存multipart/form-data消息体中上传的文件
+    HTTP_CODE do_upload();
+
+    //流式接收消息体：创建临时文件，已读入缓冲区的部分消息体先写入文件
+    bool start_body();
+    //流式接收消息体：从套接字读取剩余的消息体写入临时文件，对端关闭或出错返回false
+    bool read_body();
+    //关闭临时文件和splice使用的管道，归还上传名额
+    //请求处理完毕、短连接响应发送完毕以及连接关闭（release_resources）时调用，中途断开的上传同样归还
+    void end_body();
+    //进入新的阶段，按该阶段的超时时间设置截止时间
+    void set_phase(PHASE phase);
+    //发送有进展时重新计算截止时间：开始发送时刻 + 宽限时间 + 已发送字节数按最低速率所需的时间
+    void update_send_deadline();
+    //得到文件大小后解析Range请求头，区间存入m_ranges
+    //返回区间个数；0表示忽略Range返回完整文件；-1表示没有可满足的区间
+    int parse_range();
+    //条件GET：If-None-Match与ETag匹配，或没有If-None-Match时文件在If-Modified-Since之后未修改
+    bool not_modified();
+    //内容协商：可压缩的文件按Accept-Encoding选择预压缩的同名.br/.gz文件或后台生成的压缩副本
+    void negotiate_encoding();
+    //内置的路由处理函数
+    static HTTP_CODE serve_page(http_conn *conn, const char *page);
+    static HTTP_CODE handle_login(http_conn *conn, const char *arg);
+    static HTTP_CODE handle_register(http_conn *conn, const char *arg);
+    static HTTP_CODE handle_health(http_conn *conn, const char *arg);
+    static HTTP_CODE handle_stats(http_conn *conn, const char *arg);
+    //从登录和注册表单（user=123&password=123）中取出用户名和密码，流式接收的消息体不是表单
+    bool parse_credentials(char *name, char *password);
+    //当前响应内容的ETag，压缩副本在原文件的ETag上附加编码后缀
+    void get_etag(char *buf, int size);
 
     //m_start_line是已经解析的字符
     //get_line用于将指针向后偏移，指向未处理的字符
@@ -124,34 +277,81 @@ private:
     }
     //从状态机读取一行，分析是请求报文的哪一部分
     LINE_STATUS parse_line();
-    /*封装munmap函数
-        mmap函数：用于申请一段内存空间。可以将这段内存作为进程间通信的共享内存，也可以将文件直接映射到其中。
-        munmap函数：则释放由mmap创建的这段内存空间
+    /*释放目标文件
+        文件的描述符和mmap映射由文件缓存持有，这里只释放本次响应对缓存条目的引用
     */
     void unmap();
+    //长连接：当前请求的响应已生成，重置解析状态，之后的流水线请求数据移到读缓冲区开头
+    void next_request();
+    //把刚生成的响应加入待发送队列，头部从m_write_buf的head_start开始，body为文件内容或完整响应报文
+    bool queue_response(int head_start, const char *body, long long body_len);
+    //一批响应生成完毕，按顺序组装iovec
+    void build_iov();
+
+    //读缓冲区：首次读取时从缓冲区池借用，写满后换用更大一级的缓冲区，超过上限返回false
+    bool grow_read_buf();
+    //写缓冲区：生成响应时借用，响应头部写满后换用更大一级的缓冲区
+    bool grow_write_buf();
+    //请求处理完毕（长连接空闲或关闭）时将读写缓冲区归还给缓冲区池
+    void free_read_buf();
+    void free_write_buf();
+    void free_buffers();
 
     //根据响应报文格式，生成对应8个部分，以下函数均由do_request调用
-    bool add_response(const char *format, ...);
+    //响应头部由常量片段和整数拼接而成，不经过vsnprintf：add_bytes追加一段内容，add_number追加十进制整数
+    bool add_bytes(const char *data, int len);
+    bool add_number(long long value);
+    template <int N>
+    bool add_literal(const char (&str)[N])
+    {
+        return add_bytes(str, N - 1);
+    }
     bool add_content(const char *content);
+    //状态行，之后紧跟事件循环缓存的Date头部
     bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
+    bool add_headers(long long content_length);
     bool add_content_type();
-    bool add_content_length(int content_length);
+    bool add_content_length(long long content_length);
+    //Content-Range:bytes first-last/文件大小
+    bool add_content_range(long long first, long long last);
+    //文件响应的Accept-Ranges、ETag、Last-Modified、Cache-Control、Content-Encoding和Vary
+    bool add_file_headers();
+    //多区间响应：multipart/byteranges，每个区间的内容直接指向文件映射
+    bool add_byteranges(int head_start);
     bool add_linger();
     bool add_blank_line();
 
 public:
-    static int m_epollfd;       //epoll I/O复用内核事件表的文件描述符（因为所有的用户请求事件都注册在同一张内核事件表上，因此为static）
-    static int m_user_count;    //总用户量
+    static std::atomic<int> m_user_count;    //总用户量（多Reactor模式下由多个线程并发修改，因此为原子变量）
+    static std::atomic<bool> m_draining;     //平滑升级排空阶段，响应后不再保持长连接
+    static std::vector<std::pair<string, string> > m_cache_control;  //{路径前缀，Cache-Control取值}，按前缀从长到短排列
+    static long long m_max_body;             //消息体长度上限（字节）
+    static route_table<route> m_routes;      //请求路径到处理函数的路由表，启动时注册，之后只读
+    static long long m_write_quota;          //每个连接每轮写事件最多发送的字节数，0表示不限制
+    static std::atomic<unsigned long long> m_write_yields;  //因配额用完而让出的次数
+    static int m_header_timeout;             //接收请求头部的时限（毫秒）
+    static int m_body_timeout;               //接收消息体的时限（毫秒）
+    static int m_idle_timeout;               //长连接空闲的时限（毫秒）
+    static long long m_min_send_rate;        //发送响应的最低平均速率（字节/秒），0表示只要求宽限时间内有进展
+    static int m_max_requests;               //每个长连接最多处理的请求数，0表示不限制
+    static int m_busy_conns;                 //连接数达到该值后，响应后不再保持长连接
+    static std::atomic<int> m_uploads;       //正在流式接收消息体的连接数
+    static std::atomic<unsigned long long> m_idle_evictions;  //为新连接让出槽位而淘汰的空闲长连接数
     MYSQL *mysql;               //mysql对象，在其它头文件中include
     int m_state;                //0-读；1-写
+    completion_queue<http_conn> *m_cq;  //向所属事件循环汇报任务完成的队列
+    client_data m_timer_data;           //连接资源（定时器用户数据），随连接对象一起分配
 
 private:
+    int m_epollfd;              //epoll I/O复用内核事件表的文件描述符（多Reactor模式下连接注册在各自子Reactor的内核事件表上）
     int m_sockfd;               //用于通信的套接字，每个用户不同
+    unsigned int m_serial;      //连接序号，区分同一个对象先后服务的不同连接
     sockaddr_in m_address;
 
-    //存储读取的请求报文数据，通过read_once读取
-    char m_read_buf[READ_BUFFER_SIZE];
+    //存储读取的请求报文数据，通过read_once读取，处理请求期间从缓冲区池借用
+    char *m_read_buf;
+    //读缓冲区大小
+    int m_read_size;
     //缓冲区中m_read_buf中数据的最后一个字节的下一个位置
     int m_read_idx;
     //m_read_buf读取的位置m_checked_idx
@@ -159,8 +359,10 @@ private:
     //m_read_buf中已经解析的字符个数
     int m_start_line;
 
-    //存储发送的响应报文数据
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    //存储发送的响应报文数据，生成响应时从缓冲区池借用
+    char *m_write_buf;
+    //写缓冲区大小
+    int m_write_size;
     //指示buffer中的长度
     int m_write_idx;
 
@@ -174,18 +376,72 @@ private:
     char *m_url;                        //客户请求的目标文件的文件名
     char *m_version;                    //http协议版本
     char *m_host;                       //域名
-    int m_content_length;               //请求数据长度
+    //头部索引：每个请求头的名称和取值在m_read_buf中的偏移，读缓冲区扩大后仍然有效
+    struct header_field
+    {
+        int name;                       //名称的偏移
+        int name_len;                   //名称长度
+        int value;                      //取值的偏移，去掉首尾空白，以'\0'结尾
+    };
+    header_field m_headers[MAX_HEADERS];
+    int m_header_count;
+    //do_request开始时从头部索引取出
+    const char *m_range;                //Range请求头，NULL表示请求完整文件
+    const char *m_if_range;             //If-Range请求头，与文件的ETag或Last-Modified一致时Range才生效
+    const char *m_if_none_match;        //If-None-Match请求头
+    const char *m_if_modified_since;    //If-Modified-Since请求头
+    const char *m_accept_encoding;      //Accept-Encoding请求头
+    long long m_content_length;         //请求数据长度
     bool m_linger;                      //HTTP请求是否要求保持连接
 
     //
     char *m_file_address;               //客户请求的目标文件被mmap到内存逻辑地址的起始位置
+    file_entry *m_file;                 //目标文件的缓存条目，响应发送完毕后释放
+    int m_file_fd;                      //sendfile模式下目标文件的描述符，-1表示使用mmap
+    off_t m_file_offset;                //sendfile模式下文件内容的发送偏移
+    off_t m_file_end;                   //sendfile模式下文件内容的结束偏移，单区间请求时为区间末尾
+    off_t m_readahead;                  //sendfile模式下已提示内核预读到的偏移
+    struct byte_range
+    {
+        off_t first;                    //区间首字节偏移
+        off_t last;                     //区间末字节偏移（包含）
+    };
+    byte_range m_ranges[MAX_RANGES];    //Range请求的区间
+    int m_range_count;                  //区间个数，0表示完整文件
+    const char *m_encoding;             //响应的Content-Encoding，NULL表示原始内容
+    const std::string *m_encoded;       //后台生成的压缩副本，NULL表示内容来自文件（原文件或预压缩文件）
+    bool m_vary;                        //可压缩的文件，响应随Accept-Encoding变化
     struct stat m_file_stat;            //目标文件的状态。通过它可以判断文件是否存在、是否为目录、是否可读，并获取文件大小等信息
-    struct iovec m_iv[2];               //io向量机制，使用writev执行写操作
+    struct iovec m_iv[2 * MAX_PARTS];   //io向量机制，每个响应片段的头部和内容各占一个，一次sendmsg发送
     int m_iv_count;                     //被写内存块的数量
+
+    //已生成、尚未发送的响应，头部在m_write_buf中按顺序存放
+    struct response_part
+    {
+        int head_start;                 //头部在m_write_buf中的偏移（写缓冲区扩大时地址会变，组装iovec时再换算）
+        int head_len;
+        const char *body;               //文件内容或完整响应报文
+        long long body_len;
+        file_entry *file;               //body所在的文件缓存条目，发送完毕后释放
+    };
+    response_part m_parts[MAX_PARTS];
+    int m_part_count;
+    bool m_keep_alive;                  //本批响应发送完毕后是否保持连接（最后一个请求的m_linger）
+    char m_content_end;                 //parse_content截断消息体时覆盖的字节，可能是下一个流水线请求的首字节
     int cgi;                            //是否启用POST，1-POST，0-非POST（用于登录校验功能）
     char *m_string;                     //存储请求数据（POST中为用户名和密码）
-    int bytes_to_send;                  //剩余发送字节数
-    int bytes_have_send;                //已发送字节数
+    int m_body_fd;                      //流式接收的消息体所在的临时文件，-1表示消息体在读缓冲区中
+    int m_pipe[2];                      //splice从套接字搬运到临时文件时中转的管道
+    long long m_body_left;              //流式接收时尚未接收的消息体字节数
+    int m_upload_count;                 //本次上传保存的文件数
+    const char *m_memory_body;          //路由处理函数生成的响应内容
+    int m_memory_len;
+    const char *m_memory_type;          //响应内容的Content-Type
+    long long bytes_to_send;            //剩余发送字节数，大文件可能超过2GB
+    long long bytes_have_send;          //已发送字节数
+    PHASE m_phase;                      //连接当前的阶段
+    int m_request_count;                //本连接已处理的请求数
+    long long m_write_start;            //本批响应开始发送的时刻（毫秒，单调时钟）
     char *doc_root;                     //文件根目录
 
     map<string, string> m_users;        //{用户名，密码}
@@ -0,0 +1,105 @@
+#include "http_scanner.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCANNER_X86 1
+#include <immintrin.h>
+#endif
+
+const char *http_scanner::s_impl = "scalar";
+http_scanner::find_func http_scanner::s_find_eol = http_scanner::select();
+
+http_scanner::find_func http_scanner::select()
+{
+    if (has_avx2())
+    {
+        s_impl = "avx2";
+        return find_eol_avx2;
+    }
+    if (has_sse42())
+    {
+        s_impl = "sse4.2";
+        return find_eol_sse42;
+    }
+    s_impl = "scalar";
+    return find_eol_scalar;
+}
+
+bool http_scanner::has_sse42()
+{
+#ifdef SCANNER_X86
+    //静态初始化阶段调用，须先初始化CPU信息
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+bool http_scanner::has_avx2()
+{
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+const char *http_scanner::find_eol_scalar(const char *p, const char *end)
+{
+    for (; p < end; ++p)
+    {
+        if (*p == '\r' || *p == '\n')
+            return p;
+    }
+    return end;
+}
+
+#ifdef SCANNER_X86
+
+//pcmpestri以"\r\n"为字符集，返回16字节中第一个属于字符集的字节下标，没有则返回16
+__attribute__((target("sse4.2")))
+const char *http_scanner::find_eol_sse42(const char *p, const char *end)
+{
+    const __m128i set = _mm_setr_epi8('\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        int idx = _mm_cmpestri(set, 2, chunk, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16)
+            return p + idx;
+    }
+    return find_eol_scalar(p, end);
+}
+
+//分别与'\r'和'\n'比较，合并后的掩码中最低的置位即第一个行结束符
+__attribute__((target("avx2")))
+const char *http_scanner::find_eol_avx2(const char *p, const char *end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, cr), _mm256_cmpeq_epi8(chunk, lf));
+        unsigned int mask = _mm256_movemask_epi8(eq);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    //不足32字节的剩余部分
+    return find_eol_sse42(p, end);
+}
+
+#else
+
+const char *http_scanner::find_eol_sse42(const char *p, const char *end)
+{
+    return find_eol_scalar(p, end);
+}
+
+const char *http_scanner::find_eol_avx2(const char *p, const char *end)
+{
+    return find_eol_scalar(p, end);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef HTTP_SCANNER_H
+#define HTTP_SCANNER_H
+
+/*************************************************************
+* 请求报文扫描：用SIMD指令一次比较多个字节，查找请求行和头部的行结束符
+* 运行时检测CPU：支持AVX2时每次比较32字节，支持SSE4.2时用pcmpestri每次比较16字节，否则逐字节查找
+* 向量加载只在剩余数据足够一个向量时进行，不会读到缓冲区末尾之后
+**************************************************************/
+
+class http_scanner
+{
+public:
+    //返回[p, end)中第一个'\r'或'\n'的位置，没有则返回end
+    static const char *find_eol(const char *p, const char *end)
+    {
+        return s_find_eol(p, end);
+    }
+    //当前使用的实现名称：avx2、sse4.2或scalar
+    static const char *impl()
+    {
+        return s_impl;
+    }
+
+    //各个实现，供基准测试直接调用；CPU不支持的实现不能调用
+    static const char *find_eol_scalar(const char *p, const char *end);
+    static const char *find_eol_sse42(const char *p, const char *end);
+    static const char *find_eol_avx2(const char *p, const char *end);
+    //CPU是否支持对应的实现
+    static bool has_sse42();
+    static bool has_avx2();
+
+private:
+    typedef const char *(*find_func)(const char *, const char *);
+    //启动时根据CPU选择实现
+    static find_func select();
+
+    static find_func s_find_eol;
+    static const char *s_impl;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "multipart.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+bool multipart::get_boundary(const char *content_type, std::string &boundary)
+{
+    if (!content_type || strncasecmp(content_type, "multipart/form-data", 19) != 0)
+        return false;
+    const char *p = strcasestr(content_type, "boundary=");
+    if (!p)
+        return false;
+    p += 9;
+    //boundary可以带引号
+    if ('"' == *p)
+    {
+        const char *end = strchr(p + 1, '"');
+        if (!end)
+            return false;
+        boundary.assign(p + 1, end);
+    }
+    else
+        boundary.assign(p, strcspn(p, " \t;"));
+    //RFC 2046：boundary为1到70个字符
+    return !boundary.empty() && boundary.size() <= 70;
+}
+
+int multipart::save_files(int fd, long long len, const std::string &boundary, const char *dir)
+{
+    if (len <= 0)
+        return -1;
+    char *map = (char *)mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+        return -2;
+    madvise(map, len, MADV_SEQUENTIAL);
+
+    //第一个分隔行之前的内容（preamble）忽略，之后每个分隔行前都有\r\n
+    std::string delim = "--" + boundary;
+    std::string next_delim = "\r\n" + delim;
+    const char *end = map + len;
+    const char *p = (const char *)memmem(map, len, delim.data(), delim.size());
+    int count = 0;
+    while (p)
+    {
+        p += delim.size();
+        //结束分隔行
+        if (end - p >= 2 && '-' == p[0] && '-' == p[1])
+            break;
+        if (end - p < 2 || p[0] != '\r' || p[1] != '\n')
+        {
+            count = -1;
+            break;
+        }
+        p += 2;
+        //字段头部以空行结束
+        const char *head_end = (const char *)memmem(p, end - p, "\r\n\r\n", 4);
+        if (!head_end || head_end - p > MAX_PART_HEADER)
+        {
+            count = -1;
+            break;
+        }
+        std::string header(p, head_end - p);
+        const char *data = head_end + 4;
+        const char *data_end = (const char *)memmem(data, end - data, next_delim.data(), next_delim.size());
+        if (!data_end)
+        {
+            count = -1;
+            break;
+        }
+
+        std::string name;
+        if (get_filename(header, name))
+        {
+            std::string path = std::string(dir) + "/" + name;
+            int out = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (-1 == out)
+            {
+                count = -2;
+                break;
+            }
+            bool ok = copy_range(fd, data - map, data_end - data, out, data);
+            close(out);
+            if (!ok)
+            {
+                unlink(path.c_str());
+                count = -2;
+                break;
+            }
+            ++count;
+        }
+        p = data_end + 2;
+    }
+    //没有找到任何分隔行
+    if (!p && 0 == count)
+        count = -1;
+    munmap(map, len);
+    return count;
+}
+
+bool multipart::get_filename(const std::string &header, std::string &name)
+{
+    //Content-Disposition: form-data; name="file"; filename="a.txt"，普通字段没有filename
+    const char *p = strcasestr(header.c_str(), "filename=\"");
+    if (!p)
+        return false;
+    p += 10;
+    const char *end = strchr(p, '"');
+    if (!end)
+        return false;
+    //部分浏览器发送完整路径，只取最后一个路径分量
+    for (const char *q = p; q < end; ++q)
+    {
+        if ('/' == *q || '\\' == *q)
+            p = q + 1;
+    }
+    name.assign(p, end);
+    if (name.empty() || '.' == name[0] || name.size() > 255)
+        return false;
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        if ((unsigned char)name[i] < 0x20 || 0x7f == name[i])
+            return false;
+    }
+    return true;
+}
+
+bool multipart::copy_range(int fd, off_t off, long long len, int out, const char *src)
+{
+    //copy_file_range在内核中复制，同一文件系统上还可能直接共享数据块
+    while (len > 0)
+    {
+        ssize_t n = copy_file_range(fd, &off, out, NULL, len, 0);
+        if (n > 0)
+        {
+            len -= n;
+            src += n;
+            continue;
+        }
+        if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+            break;
+        return false;
+    }
+    //内核不支持时从映射写入
+    while (len > 0)
+    {
+        ssize_t n = write(out, src, len);
+        if (n <= 0)
+            return false;
+        len -= n;
+        src += n;
+    }
+    return true;
+}
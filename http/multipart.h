@@ -0,0 +1,32 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include <string>
+#include <sys/types.h>
+
+/*************************************************************
+* multipart/form-data解析：消息体已流式保存在临时文件中，映射后按分隔行切分各个字段
+* 文件字段用copy_file_range从临时文件直接复制到上传目录，不经过用户态缓冲区；普通字段忽略
+* 文件名只取最后一个路径分量，拒绝空文件名和以'.'开头的文件名，同名文件被覆盖
+**************************************************************/
+
+class multipart
+{
+public:
+    //从Content-Type请求头中取出boundary，不是multipart/form-data或没有boundary时返回false
+    static bool get_boundary(const char *content_type, std::string &boundary);
+    //解析fd中长度为len的消息体，把其中的文件保存到dir目录
+    //返回保存的文件个数，消息体格式错误返回-1，写入上传目录失败返回-2
+    static int save_files(int fd, long long len, const std::string &boundary, const char *dir);
+
+public:
+    static const int MAX_PART_HEADER = 8192;    //单个字段头部的长度上限
+
+private:
+    //从字段头部中取出上传文件名，没有文件名或文件名不安全时返回false
+    static bool get_filename(const std::string &header, std::string &name);
+    //把fd中[off, off + len)复制到out，内核不支持copy_file_range时从映射src写入
+    static bool copy_range(int fd, off_t off, long long len, int out, const char *src);
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef ROUTE_TABLE_H
+#define ROUTE_TABLE_H
+
+#include <string.h>
+#include <string>
+#include <vector>
+
+/*************************************************************
+* 路由表：请求路径精确匹配到路由项，启动时注册，之后只读，各线程并发查找无需加锁
+* 每次注册后重新选择哈希种子，使所有路径落在不同的槽位（完美哈希）
+* 查找只需一次哈希和一次比较，与注册的路径数无关；未命中的槽位直接返回NULL
+* 模板参数T为路由项内容，由使用方定义（如处理函数和参数）
+**************************************************************/
+
+template <typename T>
+class route_table
+{
+public:
+    route_table() : m_seed(0), m_mask(0) {}
+
+    //注册路径，已注册的路径会被替换
+    void add(const char *path, const T &value)
+    {
+        for (size_t i = 0; i < m_routes.size(); ++i)
+        {
+            if (m_routes[i].first == path)
+            {
+                m_routes[i].second = value;
+                return;
+            }
+        }
+        m_routes.push_back(std::make_pair(std::string(path), value));
+        build();
+    }
+
+    //查找path的前len个字符，没有对应的路由返回NULL
+    const T *find(const char *path, size_t len) const
+    {
+        if (m_slots.empty())
+            return NULL;
+        int idx = m_slots[hash(path, len, m_seed) & m_mask];
+        if (idx < 0)
+            return NULL;
+        const std::string &key = m_routes[idx].first;
+        if (key.size() != len || memcmp(key.data(), path, len) != 0)
+            return NULL;
+        return &m_routes[idx].second;
+    }
+
+    size_t size() const
+    {
+        return m_routes.size();
+    }
+
+private:
+    //FNV-1a，以种子作为初始值的一部分，换种子即换一个哈希函数
+    static unsigned int hash(const char *s, size_t len, unsigned int seed)
+    {
+        unsigned int h = 2166136261u ^ (seed * 0x9e3779b9u);
+        for (size_t i = 0; i < len; ++i)
+        {
+            h ^= (unsigned char)s[i];
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+    //槽位数从路径数的两倍起，每个大小尝试一批种子，找不到无冲突的种子时槽位数加倍
+    void build()
+    {
+        size_t size = 8;
+        while (size < m_routes.size() * 2)
+            size <<= 1;
+        while (true)
+        {
+            for (unsigned int seed = 0; seed < MAX_SEEDS; ++seed)
+            {
+                if (try_build(size, seed))
+                    return;
+            }
+            size <<= 1;
+        }
+    }
+
+    bool try_build(size_t size, unsigned int seed)
+    {
+        std::vector<int> slots(size, -1);
+        for (size_t i = 0; i < m_routes.size(); ++i)
+        {
+            const std::string &key = m_routes[i].first;
+            int &slot = slots[hash(key.data(), key.size(), seed) & (size - 1)];
+            if (slot != -1)
+                return false;
+            slot = i;
+        }
+        m_slots.swap(slots);
+        m_seed = seed;
+        m_mask = size - 1;
+        return true;
+    }
+
+private:
+    static const unsigned int MAX_SEEDS = 1024;
+
+    std::vector<std::pair<std::string, T> > m_routes;
+    std::vector<int> m_slots;       //槽位中存放路由项在m_routes中的下标，-1表示空槽
+    unsigned int m_seed;
+    size_t m_mask;
+};
+
+#endif
@@ -16,7 +16,11 @@ int main(int argc, char *argv[])
     //初始化
     server.init(config.PORT, user, passwd, databasename, config.LOGWrite, 
                 config.OPT_LINGER, config.TRIGMode,  config.sql_num,  config.thread_num, 
-                config.close_log, config.actor_model);
+                config.close_log, config.actor_model, config.reactor_num,
+                config.reuseport, config.backlog, config.io_backend, config.tick_ms, config.busy_poll,
+                config.cache_control, config.max_body, config.write_quota,
+                config.header_timeout, config.body_timeout, config.idle_timeout, config.min_send_rate,
+                config.max_requests, config.max_idle);
     
 
     //日志
@@ -0,0 +1,218 @@
+#include "sub_reactor.h"
+#include "../webserver.h"
+
+sub_reactor::sub_reactor()
+{
+    m_server = NULL;
+    m_index = 0;
+    m_running = false;
+    m_stop = false;
+    m_stop_accept = false;
+    m_wakeupfd = -1;
+    m_timerfd = -1;
+    m_epollfd = -1;
+    m_listenfd = -1;
+    m_idlefd = -1;
+    m_events = NULL;
+    m_close_log = 0;
+}
+
+sub_reactor::~sub_reactor()
+{
+    stop();
+    if (m_wakeupfd != -1)
+        close(m_wakeupfd);
+    if (m_timerfd != -1)
+        close(m_timerfd);
+    if (m_epollfd != -1)
+        close(m_epollfd);
+    if (m_listenfd != -1)
+        close(m_listenfd);
+    if (m_idlefd != -1)
+        close(m_idlefd);
+    delete[] m_events;
+}
+
+void sub_reactor::init(WebServer *server, int index, int close_log, int listenfd)
+{
+    m_server = server;
+    m_index = index;
+    m_close_log = close_log;
+    m_listenfd = listenfd;
+
+    //每个子Reactor拥有独立的内核事件表
+    m_epollfd = epoll_create(5);
+    assert(m_epollfd != -1);
+    m_events = new epoll_event[MAX_EVENT_NUMBER];
+
+    //主Reactor通过eventfd唤醒子Reactor，注册读事件（LT，不使用EPOLLONESHOT）
+    //与主Reactor一致，data.ptr为对应成员变量的地址，连接为http_conn对象
+    m_wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(m_wakeupfd != -1);
+    epoll_event event;
+    event.data.ptr = &m_wakeupfd;
+    event.events = EPOLLIN;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_wakeupfd, &event);
+
+    //Reactor模式下工作线程的完成通知
+    event.data.ptr = &m_cq;
+    event.events = EPOLLIN;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_cq.get_fd(), &event);
+
+    //SO_REUSEPORT分片：监听socket注册到本子Reactor，不能注册EPOLLONESHOT
+    if (m_listenfd != -1)
+    {
+        m_server->utils.addfd(m_epollfd, m_listenfd, false, m_server->m_LISTENTrigmode, &m_listenfd);
+        m_idlefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    //定时器链表由本子Reactor自己的timerfd驱动
+    m_timerfd = m_server->utils.create_tickfd();
+    event.data.ptr = &m_timerfd;
+    event.events = EPOLLIN;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_timerfd, &event);
+}
+
+void sub_reactor::start()
+{
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        throw std::exception();
+    }
+    m_running = true;
+}
+
+void sub_reactor::stop()
+{
+    if (!m_running)
+        return;
+    m_stop = true;
+    wakeup();
+    pthread_join(m_thread, NULL);
+    m_running = false;
+}
+
+//主Reactor调用：新连接先放入待注册队列，再唤醒子Reactor，由子Reactor线程完成注册
+//连接的初始化、定时器的添加都在子Reactor线程中完成，因此定时器链表无需加锁
+void sub_reactor::dispatch(int connfd, const sockaddr_in &address)
+{
+    pending_conn conn;
+    conn.connfd = connfd;
+    conn.address = address;
+
+    m_lock.lock();
+    m_pending.push_back(conn);
+    m_lock.unlock();
+
+    wakeup();
+}
+
+//监听socket只在本子Reactor线程中使用，由该线程自己关闭
+void sub_reactor::stop_accept()
+{
+    m_stop_accept = true;
+    wakeup();
+}
+
+void sub_reactor::wakeup()
+{
+    uint64_t one = 1;
+    ::write(m_wakeupfd, &one, sizeof(one));
+}
+
+void *sub_reactor::worker(void *arg)
+{
+    //SIGTERM由主线程通过signalfd处理，子Reactor线程继承了主线程屏蔽SIGTERM的信号掩码
+    sub_reactor *reactor = (sub_reactor *)arg;
+    reactor->run();
+    return reactor;
+}
+
+void sub_reactor::deal_dispatch()
+{
+    uint64_t count;
+    ::read(m_wakeupfd, &count, sizeof(count));
+
+    //整体取出待注册队列，缩短持锁时间
+    std::list<pending_conn> pending;
+    m_lock.lock();
+    pending.swap(m_pending);
+    m_lock.unlock();
+
+    for (std::list<pending_conn>::iterator it = pending.begin(); it != pending.end(); ++it)
+    {
+        m_server->timer(it->connfd, it->address, m_epollfd, &m_timer_lst, &m_cq);
+    }
+
+    if (m_stop_accept && m_listenfd != -1)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+        close(m_listenfd);
+        m_listenfd = -1;
+    }
+}
+
+void sub_reactor::run()
+{
+    while (!m_stop)
+    {
+        int number = m_server->utils.wait_events(m_epollfd, m_events, MAX_EVENT_NUMBER);
+        if (number < 0 && errno != EINTR)
+        {
+            LOG_ERROR("sub reactor %d epoll failure", m_index);
+            break;
+        }
+        date_cache::get_instance()->update();
+
+        bool timeout = false;
+        for (int i = 0; i < number; i++)
+        {
+            void *ptr = m_events[i].data.ptr;
+
+            //本分片的监听socket上有新连接
+            if (ptr == &m_listenfd)
+            {
+                m_server->dealclientdata(m_listenfd, this);
+            }
+            //主Reactor投递了新连接
+            else if (ptr == &m_wakeupfd)
+            {
+                deal_dispatch();
+            }
+            //定时器到期
+            else if (ptr == &m_timerfd)
+            {
+                uint64_t expirations;
+                ::read(m_timerfd, &expirations, sizeof(expirations));
+                timeout = true;
+            }
+            //工作线程汇报的读写完成结果
+            else if (ptr == &m_cq)
+            {
+                m_server->dealwithcompletion(&m_cq);
+            }
+            //处理：对端半关闭连接(CLOSE_WAIT)、连接断开、错误等事件
+            else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                http_conn *conn = (http_conn *)ptr;
+                m_server->deal_timer(conn->m_timer_data.timer);
+            }
+            //处理读事件
+            else if (m_events[i].events & EPOLLIN)
+            {
+                m_server->dealwithread((http_conn *)ptr);
+            }
+            //处理写事件
+            else if (m_events[i].events & EPOLLOUT)
+            {
+                m_server->dealwithwrite((http_conn *)ptr);
+            }
+        }
+
+        //处理本子Reactor定时器链表上的超时连接
+        if (timeout)
+        {
+            m_timer_lst.tick();
+        }
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef SUB_REACTOR_H
+#define SUB_REACTOR_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <list>
+
+#include "../lock/locker.h"
+#include "../timer/lst_timer.h"
+#include "../threadpool/completion_queue.h"
+
+/*************************************************************
+* 子Reactor：主从Reactor模式（one loop per thread）中的从Reactor
+* 主Reactor（主线程）只负责accept新连接，并以轮询方式分发给各个子Reactor
+* SO_REUSEPORT分片模式下，每个子Reactor拥有自己的监听socket，由内核分配新连接，子Reactor自行accept
+* 每个子Reactor运行在独立线程中，拥有独立的epoll内核事件表、连接集合和定时器链表，
+* 负责所分配连接上的全部I/O事件及超时处理，业务逻辑仍交给线程池
+**************************************************************/
+
+class WebServer;
+class http_conn;
+
+class sub_reactor
+{
+public:
+    sub_reactor();
+    ~sub_reactor();
+
+    //创建内核事件表和唤醒用的eventfd，listenfd为本子Reactor的监听socket（-1表示由主Reactor分发连接）
+    void init(WebServer *server, int index, int close_log, int listenfd);
+    //创建子Reactor线程
+    void start();
+    //通知子Reactor线程退出并回收
+    void stop();
+    //主Reactor调用：将新连接投递给当前子Reactor
+    void dispatch(int connfd, const sockaddr_in &address);
+    //平滑升级：通知子Reactor关闭自己的监听socket
+    void stop_accept();
+
+private:
+    //线程运行函数，内部调用私有函数run
+    static void *worker(void *arg);
+    //子Reactor事件循环
+    void run();
+    //取出主Reactor投递的新连接，注册到本子Reactor
+    void deal_dispatch();
+    //唤醒阻塞在epoll_wait上的子Reactor线程
+    void wakeup();
+
+private:
+    //待注册的新连接
+    struct pending_conn
+    {
+        int connfd;
+        sockaddr_in address;
+    };
+
+    WebServer *m_server;
+    int m_index;                        //子Reactor编号
+    pthread_t m_thread;
+    bool m_running;
+    volatile bool m_stop;
+    volatile bool m_stop_accept;
+
+    int m_wakeupfd;                     //eventfd，主Reactor投递连接或通知退出时写入
+    locker m_lock;                      //保护待注册连接队列
+    std::list<pending_conn> m_pending;  //主Reactor投递、尚未注册的新连接
+    int m_timerfd;                      //本子Reactor的定时器链表检查周期
+
+    epoll_event *m_events;
+    int m_close_log;
+
+public:
+    int m_epollfd;                      //本子Reactor的内核事件表
+    int m_listenfd;                     //本子Reactor的SO_REUSEPORT监听socket，未分片时为-1
+    int m_idlefd;                       //本子Reactor自行accept时使用的备用描述符
+    sort_timer_lst m_timer_lst;         //本子Reactor的定时器链表
+    completion_queue<http_conn> m_cq;   //Reactor模式下工作线程向本子Reactor汇报完成的队列
+};
+
+#endif
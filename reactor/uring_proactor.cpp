@@ -0,0 +1,773 @@
+#include "uring_proactor.h"
+#include "../webserver.h"
+
+#include <poll.h>
+
+//io_uring系统调用封装
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+//user_data编码/解码
+static uint64_t make_data(int op, unsigned int serial, int fd)
+{
+    return ((uint64_t)op << 56) | ((uint64_t)(serial & 0xffffff) << 32) | (uint32_t)fd;
+}
+
+static int data_op(uint64_t data)
+{
+    return (int)(data >> 56);
+}
+
+static unsigned int data_serial(uint64_t data)
+{
+    return (unsigned int)((data >> 32) & 0xffffff);
+}
+
+static int data_fd(uint64_t data)
+{
+    return (int)(data & 0xffffffff);
+}
+
+uring_proactor::uring_proactor()
+{
+    m_server = NULL;
+    m_close_log = 0;
+    m_ring_fd = -1;
+    m_sq_ptr = NULL;
+    m_cq_ptr = NULL;
+    m_sqes = NULL;
+    m_bufs = NULL;
+    m_sqe_tail = 0;
+    m_timeout = false;
+    m_stop = false;
+    m_accepting = true;
+}
+
+uring_proactor::~uring_proactor()
+{
+    delete[] m_bufs;
+    if (m_sqes)
+        munmap(m_sqes, m_sqes_size);
+    if (m_cq_ptr && m_cq_ptr != m_sq_ptr)
+        munmap(m_cq_ptr, m_cq_size);
+    if (m_sq_ptr)
+        munmap(m_sq_ptr, m_sq_size);
+    if (m_ring_fd != -1)
+        close(m_ring_fd);
+}
+
+bool uring_proactor::init(WebServer *server, int close_log)
+{
+    m_server = server;
+    m_close_log = close_log;
+
+    if (!setup_ring(RING_ENTRIES) || !setup_buffers())
+        return false;
+
+    m_state.assign(MAX_FD, CONN_IDLE);
+    m_close_pending.assign(MAX_FD, 0);
+    m_recv.assign(MAX_FD, RECV_ON);
+    return true;
+}
+
+bool uring_proactor::setup_ring(unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    //完成队列设为提交队列的4倍，multishot请求会持续产生完成事件
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    m_ring_fd = io_uring_setup(entries, &p);
+    if (m_ring_fd < 0)
+    {
+        LOG_ERROR("io_uring_setup error:%d", errno);
+        m_ring_fd = -1;
+        return false;
+    }
+
+    //映射提交队列、完成队列和SQE数组
+    m_sq_entries = p.sq_entries;
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    //新内核中提交队列和完成队列可以一次映射
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (m_cq_size > m_sq_size)
+            m_sq_size = m_cq_size;
+        m_cq_size = m_sq_size;
+    }
+    m_sq_ptr = mmap(0, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED)
+    {
+        m_sq_ptr = NULL;
+        return false;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        m_cq_ptr = m_sq_ptr;
+    }
+    else
+    {
+        m_cq_ptr = mmap(0, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ptr == MAP_FAILED)
+        {
+            m_cq_ptr = NULL;
+            return false;
+        }
+    }
+    m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe *)mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES);
+    if (m_sqes == MAP_FAILED)
+    {
+        m_sqes = NULL;
+        return false;
+    }
+
+    char *sq = (char *)m_sq_ptr;
+    m_sq_head = (unsigned *)(sq + p.sq_off.head);
+    m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned *)(sq + p.sq_off.array);
+    m_sqe_tail = *m_sq_tail;
+
+    char *cq = (char *)m_cq_ptr;
+    m_cq_head = (unsigned *)(cq + p.cq_off.head);
+    m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return true;
+}
+
+//向内核提供缓冲区组：multishot recv每次从组中取一个空闲缓冲区存放数据，完成事件中带回缓冲区编号
+bool uring_proactor::setup_buffers()
+{
+    m_bufs = new char[BUF_ENTRIES * BUF_SIZE];
+
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = BUF_ENTRIES;
+    sqe->addr = (uint64_t)(uintptr_t)m_bufs;
+    sqe->len = BUF_SIZE;
+    sqe->buf_group = BUF_GROUP;
+    sqe->off = 0;
+    sqe->user_data = make_data(OP_BUFFER, 0, 0);
+    if (submit(1) < 0)
+    {
+        LOG_ERROR("io_uring provide buffers error:%d", errno);
+        return false;
+    }
+
+    //初始化阶段同步等待结果，失败时由调用方回退到epoll
+    unsigned head = *m_cq_head;
+    struct io_uring_cqe cqe = m_cqes[head & *m_cq_mask];
+    __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+    if (cqe.res < 0)
+    {
+        LOG_ERROR("io_uring provide buffers error:%d", -cqe.res);
+        return false;
+    }
+    return true;
+}
+
+//将单个缓冲区归还给缓冲区组，随本轮其他请求一起提交，成功时不产生完成事件
+void uring_proactor::recycle_buf(unsigned short bid)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+    {
+        m_recycle_retry.push_back(bid);
+        return;
+    }
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = (uint64_t)(uintptr_t)(m_bufs + (size_t)bid * BUF_SIZE);
+    sqe->len = BUF_SIZE;
+    sqe->buf_group = BUF_GROUP;
+    sqe->off = bid;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = make_data(OP_BUFFER, 0, 0);
+}
+
+//获取一个空闲SQE，提交队列满时先提交已有请求
+struct io_uring_sqe *uring_proactor::get_sqe()
+{
+    unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (m_sqe_tail - head >= m_sq_entries)
+    {
+        submit(0);
+        head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sqe_tail - head >= m_sq_entries)
+        {
+            LOG_ERROR("%s", "io_uring submission queue full");
+            return NULL;
+        }
+    }
+    unsigned idx = m_sqe_tail & *m_sq_mask;
+    struct io_uring_sqe *sqe = &m_sqes[idx];
+    m_sq_array[idx] = idx;
+    m_sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+bool uring_proactor::reserve_sqes(unsigned n)
+{
+    if (m_sq_entries - (m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)) >= n)
+        return true;
+    submit(0);
+    return m_sq_entries - (m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)) >= n;
+}
+
+void uring_proactor::resubmit()
+{
+    std::vector<unsigned short> bids;
+    bids.swap(m_recycle_retry);
+    for (size_t i = 0; i < bids.size(); ++i)
+        recycle_buf(bids[i]);
+
+    //等待期间连接可能已关闭或进入其他状态
+    std::vector<std::pair<int, unsigned int> > sends;
+    sends.swap(m_send_retry);
+    for (size_t i = 0; i < sends.size(); ++i)
+    {
+        int fd = sends[i].first;
+        if (alive(fd, sends[i].second) && m_state[fd] == CONN_SENDING)
+            prep_send(fd);
+    }
+}
+
+//发布本地提交队列尾并进入内核，wait_nr大于0时阻塞等待完成事件
+//一次系统调用完成一轮事件循环中所有请求的提交
+int uring_proactor::submit(unsigned wait_nr)
+{
+    __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+    return io_uring_enter(m_ring_fd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+void uring_proactor::prep_accept()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return;
+    //multishot accept：一次提交，每个新连接产生一个完成事件，客户端地址由getpeername获取
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_server->m_listenfd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = make_data(OP_ACCEPT, 0, m_server->m_listenfd);
+}
+
+void uring_proactor::prep_recv(int fd, unsigned int serial)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return;
+    //multishot recv：数据到达时由内核从缓冲区组中选取缓冲区，无需为每个连接预留读缓冲区
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = make_data(OP_RECV, serial, fd);
+}
+
+void uring_proactor::prep_poll(int fd, int op, bool multishot)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = make_data(op, 0, fd);
+}
+
+//取消user_data对应的请求，取消操作本身的完成事件忽略
+void uring_proactor::prep_cancel(uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = 0;
+}
+
+void uring_proactor::watch_upgrade()
+{
+    prep_poll(m_server->m_upgradefd, OP_UPGRADE, false);
+}
+
+void uring_proactor::stop_accept()
+{
+    m_accepting = false;
+    prep_cancel(make_data(OP_ACCEPT, 0, m_server->m_listenfd));
+}
+
+//本次提交的最后一个iovec：超过MAX_SEND_LEN的iovec截断后作为最后一个，剩余部分在其完成后继续提交
+static int last_send(struct iovec *iov, int count)
+{
+    int last = -1;
+    for (int i = 0; i < count; ++i)
+    {
+        if (iov[i].iov_len == 0)
+            continue;
+        last = i;
+        if (iov[i].iov_len > uring_proactor::MAX_SEND_LEN)
+            break;
+    }
+    return last;
+}
+
+//响应报文头部和文件内容分别作为一个send请求，用IOSQE_IO_LINK串联保证顺序，一次提交
+//MSG_WAITALL使内核在发送缓冲区满时继续等待，而不是返回部分发送导致链路中断
+void uring_proactor::prep_send(int fd)
+{
+    http_conn *conn = conn_registry::get_instance()->find(fd);
+    int count = 0;
+    struct iovec *iov = conn->get_iov(count);
+    unsigned int serial = conn->get_serial();
+
+    int last = last_send(iov, count);
+    if (last < 0)
+        return;
+    //链接的请求只放入一部分时，最后一个带IOSQE_IO_LINK的请求会与之后无关的请求链接在一起
+    //空闲SQE不足时整组推迟到下一轮提交
+    unsigned needed = 0;
+    for (int i = 0; i <= last; ++i)
+    {
+        if (iov[i].iov_len != 0)
+            ++needed;
+    }
+    if (needed > m_sq_entries)
+    {
+        LOG_ERROR("send chain of %u exceeds io_uring submission queue", needed);
+        close_conn(fd);
+        return;
+    }
+    if (!reserve_sqes(needed))
+    {
+        m_send_retry.push_back(std::make_pair(fd, serial & 0xffffff));
+        return;
+    }
+    for (int i = 0; i <= last; ++i)
+    {
+        if (iov[i].iov_len == 0)
+            continue;
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)iov[i].iov_base;
+        sqe->len = iov[i].iov_len < MAX_SEND_LEN ? iov[i].iov_len : MAX_SEND_LEN;
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        if (i != last)
+        {
+            sqe->msg_flags |= MSG_MORE;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = make_data(OP_SEND_HEADER, serial, fd);
+        }
+        else
+        {
+            sqe->user_data = make_data(OP_SEND_LAST, serial, fd);
+        }
+    }
+    //最后一个请求完成前连接对象不能归还
+    ++conn->m_timer_data.tasks;
+}
+
+bool uring_proactor::alive(int fd, unsigned int serial)
+{
+    http_conn *conn = conn_registry::get_instance()->find(fd);
+    return conn && conn->m_timer_data.timer && (conn->get_serial() & 0xffffff) == serial;
+}
+
+void uring_proactor::close_conn(int fd)
+{
+    http_conn *conn = conn_registry::get_instance()->find(fd);
+    if (conn)
+        m_server->deal_timer(conn->m_timer_data.timer);
+    m_state[fd] = CONN_IDLE;
+    m_close_pending[fd] = 0;
+    m_pending.erase(fd);
+}
+
+void uring_proactor::feed(int fd, const char *data, int len, bool stalled)
+{
+    //工作线程正在处理或响应尚未发送完，先暂存，回到空闲状态后再交给连接
+    //暂存的数据达到上限后暂停接收，避免客户端持续发送流水线请求时内存无限增长
+    if (m_state[fd] != CONN_IDLE)
+    {
+        std::string &pending = m_pending[fd];
+        pending.append(data, len);
+        if (pending.size() >= MAX_PENDING)
+            pause_recv(fd);
+        return;
+    }
+    http_conn *conn = conn_registry::get_instance()->find(fd);
+    int used = conn->append_read(data, len);
+    if (used < 0 || (stalled && 0 == used && len > 0))
+    {
+        close_conn(fd);
+        return;
+    }
+    //读缓冲区放不下的部分继续暂存，工作线程处理完缓冲区中的请求后再交给连接
+    if (used < len)
+    {
+        std::string &pending = m_pending[fd];
+        pending.assign(data + used, len - used);
+        if (pending.size() >= MAX_PENDING)
+            pause_recv(fd);
+    }
+    //暂存的数据已全部交给连接
+    else
+    {
+        resume_recv(fd);
+    }
+    m_state[fd] = CONN_BUSY;
+    util_timer *timer = conn->m_timer_data.timer;
+    if (timer)
+        m_server->adjust_timer(timer);
+    if (!m_server->m_pool->append_p(conn))
+    {
+        LOG_ERROR("%s", "request queue full");
+        close_conn(fd);
+        return;
+    }
+    ++conn->m_timer_data.tasks;
+}
+
+void uring_proactor::handle_accept(struct io_uring_cqe *cqe)
+{
+    int connfd = cqe->res;
+    if (connfd == -ECANCELED)
+    {
+        //平滑升级后取消的accept
+    }
+    else if (connfd < 0)
+    {
+        LOG_ERROR("%s:errno is:%d", "accept error", -connfd);
+        //描述符耗尽时借用备用描述符拒绝一个连接，避免multishot accept反复失败
+        if ((connfd == -EMFILE || connfd == -ENFILE) && m_server->m_idlefd != -1)
+            m_server->dropconn(m_server->m_listenfd, m_server->m_idlefd);
+    }
+    //描述符超出按描述符索引的表
+    else if (connfd >= MAX_FD)
+    {
+        m_server->utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("fd %d exceeds MAX_FD", connfd);
+    }
+    //连接数已达上限且没有可淘汰的空闲长连接
+    else if (http_conn::m_user_count >= m_server->m_max_conn && m_server->utils.m_timer_lst.idle_count() == 0)
+    {
+        m_server->utils.show_error(connfd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+    }
+    else
+    {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof(client_address);
+        memset(&client_address, 0, sizeof(client_address));
+        getpeername(connfd, (struct sockaddr *)&client_address, &client_addrlength);
+
+        //io_uring后端的连接不注册到任何epoll内核事件表
+        m_server->timer(connfd, client_address, -1, &m_server->utils.m_timer_lst, &m_cq);
+        m_state[connfd] = CONN_IDLE;
+        m_close_pending[connfd] = 0;
+        m_pending.erase(connfd);
+        m_recv[connfd] = RECV_ON;
+        prep_recv(connfd, conn_registry::get_instance()->find(connfd)->get_serial());
+    }
+    //multishot请求终止（如出错）后需要重新提交
+    if (!(cqe->flags & IORING_CQE_F_MORE) && m_accepting)
+        prep_accept();
+}
+
+void uring_proactor::handle_recv(struct io_uring_cqe *cqe)
+{
+    int fd = data_fd(cqe->user_data);
+    unsigned int serial = data_serial(cqe->user_data);
+    int res = cqe->res;
+    bool has_buf = cqe->flags & IORING_CQE_F_BUFFER;
+    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    //连接已关闭（或描述符已被新连接复用），丢弃数据
+    if (!alive(fd, serial))
+    {
+        if (has_buf)
+            recycle_buf(bid);
+        return;
+    }
+
+    if (res > 0)
+    {
+        feed(fd, m_bufs + (size_t)bid * BUF_SIZE, res);
+        recycle_buf(bid);
+    }
+    //因暂停接收而取消
+    else if (res == -ECANCELED)
+    {
+        if (has_buf)
+            recycle_buf(bid);
+    }
+    //缓冲区组暂时耗尽，本轮归还的缓冲区先于重新提交的recv执行
+    else if (res != -ENOBUFS)
+    {
+        if (has_buf)
+            recycle_buf(bid);
+        //对端关闭或出错，工作线程处理中则等其完成后再关闭
+        if (m_state[fd] == CONN_BUSY)
+            m_close_pending[fd] = 1;
+        else
+            close_conn(fd);
+        return;
+    }
+
+    //multishot recv终止：暂停期间不再提交，否则重新提交
+    if (!(cqe->flags & IORING_CQE_F_MORE) && alive(fd, serial))
+    {
+        if (m_recv[fd] == RECV_CANCELLING)
+            m_recv[fd] = RECV_OFF;
+        else
+            prep_recv(fd, serial);
+    }
+}
+
+void uring_proactor::pause_recv(int fd)
+{
+    if (m_recv[fd] != RECV_ON)
+        return;
+    m_recv[fd] = RECV_CANCELLING;
+    prep_cancel(make_data(OP_RECV, conn_registry::get_instance()->find(fd)->get_serial(), fd));
+}
+
+//取消尚未生效时只需恢复状态，被取消的recv终止后照常重新提交
+void uring_proactor::resume_recv(int fd)
+{
+    if (m_recv[fd] == RECV_OFF)
+        prep_recv(fd, conn_registry::get_instance()->find(fd)->get_serial());
+    m_recv[fd] = RECV_ON;
+}
+
+void uring_proactor::handle_send(struct io_uring_cqe *cqe)
+{
+    int fd = data_fd(cqe->user_data);
+    unsigned int serial = data_serial(cqe->user_data);
+    //头部发送失败时，链接在其后的请求会以-ECANCELED完成，统一在最后一个请求中处理
+    if (data_op(cqe->user_data) != OP_SEND_LAST)
+        return;
+    //发送期间内核引用连接的写缓冲区和文件映射，连接在此期间关闭时等最后一个请求完成后再归还
+    http_conn *conn = conn_registry::get_instance()->find(fd);
+    if (!conn || (conn->get_serial() & 0xffffff) != serial)
+        return;
+    if (0 == --conn->m_timer_data.tasks && conn->m_timer_data.closing)
+    {
+        release_conn(&conn->m_timer_data);
+        return;
+    }
+    if (!alive(fd, serial))
+        return;
+
+    if (cqe->res < 0 || m_close_pending[fd])
+    {
+        close_conn(fd);
+        return;
+    }
+
+    //内核不支持send的MSG_WAITALL时可能部分发送，超大的iovec也分多次提交，继续发送剩余部分
+    int count = 0;
+    struct iovec *iov = conn->get_iov(count);
+    int last = last_send(iov, count);
+    if (last >= 0 && ((size_t)cqe->res < iov[last].iov_len || last < count - 1))
+    {
+        //发送有进展，按最低发送速率推迟截止时间，链接在前面的请求已全部发送
+        long long sent = cqe->res;
+        for (int i = 0; i < last; ++i)
+        {
+            sent += iov[i].iov_len;
+            iov[i].iov_len = 0;
+        }
+        conn->add_sent(sent);
+        iov[last].iov_base = (char *)iov[last].iov_base + cqe->res;
+        iov[last].iov_len -= cqe->res;
+        if (last_send(iov, count) >= 0)
+        {
+            prep_send(fd);
+            return;
+        }
+    }
+
+    //短连接发送完毕即关闭，长连接重置后继续接收下一个请求
+    if (!conn->send_complete())
+    {
+        close_conn(fd);
+        return;
+    }
+    m_state[fd] = CONN_IDLE;
+    util_timer *timer = conn->m_timer_data.timer;
+    if (timer)
+        m_server->adjust_timer(timer, conn->idle());
+
+    std::map<int, std::string>::iterator it = m_pending.find(fd);
+    if (it != m_pending.end())
+    {
+        std::string data;
+        data.swap(it->second);
+        m_pending.erase(it);
+        feed(fd, data.data(), data.size());
+    }
+    //读缓冲区中还有流水线请求，不等新数据到达直接交给工作线程
+    else if (conn->has_pending_request())
+    {
+        feed(fd, "", 0);
+    }
+}
+
+//工作线程处理完成：生成了响应则提交发送，请求不完整则继续接收
+void uring_proactor::handle_completion()
+{
+    std::vector<completion_queue<http_conn>::completion> done;
+    m_cq.drain(done);
+    for (size_t i = 0; i < done.size(); ++i)
+    {
+        http_conn *conn = done[i].request;
+        int fd = conn->m_timer_data.sockfd;
+        if (conn->get_serial() != done[i].serial)
+            continue;
+        //连接已在工作线程处理期间因超时关闭，任务完成后归还
+        if (0 == --conn->m_timer_data.tasks && conn->m_timer_data.closing)
+        {
+            release_conn(&conn->m_timer_data);
+            continue;
+        }
+        if (conn_registry::get_instance()->find(fd) != conn || !alive(fd, done[i].serial & 0xffffff) || m_state[fd] != CONN_BUSY)
+            continue;
+
+        if (done[i].close || m_close_pending[fd])
+        {
+            close_conn(fd);
+        }
+        else if (conn->has_response())
+        {
+            m_state[fd] = CONN_SENDING;
+            prep_send(fd);
+        }
+        else
+        {
+            m_state[fd] = CONN_IDLE;
+            std::map<int, std::string>::iterator it = m_pending.find(fd);
+            if (it != m_pending.end())
+            {
+                std::string data;
+                data.swap(it->second);
+                m_pending.erase(it);
+                feed(fd, data.data(), data.size(), true);
+            }
+        }
+    }
+}
+
+void uring_proactor::handle_cqe(struct io_uring_cqe *cqe)
+{
+    switch (data_op(cqe->user_data))
+    {
+    case OP_ACCEPT:
+        handle_accept(cqe);
+        break;
+    case OP_RECV:
+        handle_recv(cqe);
+        break;
+    case OP_SEND_HEADER:
+    case OP_SEND_LAST:
+        handle_send(cqe);
+        break;
+    case OP_TIMER:
+    {
+        bool flag = m_server->dealwithtimer(m_timeout);
+        if (false == flag)
+            LOG_ERROR("%s", "dealwithtimer failure");
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            prep_poll(m_server->m_timerfd, OP_TIMER);
+        break;
+    }
+    case OP_SIGNAL:
+    {
+        bool flag = m_server->dealwithsignal(m_stop);
+        if (false == flag)
+            LOG_ERROR("%s", "dealwithsignal failure");
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            prep_poll(m_server->m_signalfd, OP_SIGNAL);
+        break;
+    }
+    case OP_COMPLETION:
+    {
+        handle_completion();
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            prep_poll(m_cq.get_fd(), OP_COMPLETION);
+        break;
+    }
+    case OP_UPGRADE:
+    {
+        //单次poll，交接socket仍未关闭时重新提交
+        if (m_server->dealwithupgrade())
+            watch_upgrade();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void uring_proactor::run()
+{
+    prep_accept();
+    prep_poll(m_server->m_timerfd, OP_TIMER);
+    prep_poll(m_server->m_signalfd, OP_SIGNAL);
+    prep_poll(m_cq.get_fd(), OP_COMPLETION);
+
+    while (!m_stop)
+    {
+        resubmit();
+        //提交本轮产生的所有请求，并等待至少一个完成事件
+        int ret = submit(1);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            LOG_ERROR("%s", "io_uring failure");
+            break;
+        }
+        date_cache::get_instance()->update();
+
+        unsigned head = *m_cq_head;
+        while (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe cqe = m_cqes[head & *m_cq_mask];
+            head++;
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+            handle_cqe(&cqe);
+        }
+
+        if (m_timeout)
+        {
+            m_server->utils.timer_handler();
+
+            LOG_INFO("timer tick, response cache hit:%lu miss:%lu, requests:%llu heap allocs:%llu", file_cache::get_instance()->hits(), file_cache::get_instance()->misses(), alloc_counter::requests(), alloc_counter::allocs());
+
+            m_timeout = false;
+
+            //平滑升级：已有连接全部关闭后退出
+            if (m_server->drained())
+                m_stop = true;
+        }
+    }
+}
@@ -0,0 +1,157 @@
+#ifndef URING_PROACTOR_H
+#define URING_PROACTOR_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include <map>
+
+#include "../threadpool/completion_queue.h"
+
+/*************************************************************
+* io_uring后端：真正的Proactor模式，替代主线程的epoll_wait事件循环
+* 1.监听socket使用multishot accept，一次提交持续产生新连接
+* 2.连接socket使用multishot recv + 内核缓冲区组(provided buffers)，数据由内核直接收入缓冲区
+* 3.响应报文的头部和文件内容使用两个链接(IOSQE_IO_LINK)的send一次提交
+* 4.timerfd、signalfd和完成队列的eventfd使用multishot poll
+* 工作线程只负责解析请求和生成响应，完成后通过完成队列通知事件循环提交发送
+* 直接基于io_uring系统调用实现，不依赖liburing
+**************************************************************/
+
+class WebServer;
+class http_conn;
+
+class uring_proactor
+{
+public:
+    uring_proactor();
+    ~uring_proactor();
+
+    //创建io_uring实例并注册缓冲区环，内核不支持时返回false，由调用方回退到epoll
+    bool init(WebServer *server, int close_log);
+    //事件循环，收到SIGTERM后返回
+    void run();
+    //平滑升级：监听与新进程的交接socket
+    void watch_upgrade();
+    //平滑升级：取消multishot accept，须在关闭监听socket之前调用
+    void stop_accept();
+
+public:
+    //单个send请求的长度上限，更大的文件内容分多次提交
+    //每块完成后按已发送的字节数推迟截止时间，与epoll后端sendfile的分块大小一致
+    static const size_t MAX_SEND_LEN = 1 << 20;
+
+private:
+    //提交队列/完成队列的基础操作
+    bool setup_ring(unsigned entries);
+    bool setup_buffers();
+    struct io_uring_sqe *get_sqe();
+    //确保提交队列中至少有n个空闲SQE，一组链接的请求必须全部放入同一次提交
+    bool reserve_sqes(unsigned n);
+    int submit(unsigned wait_nr);
+    void recycle_buf(unsigned short bid);
+    //重新提交上一轮因提交队列满而未能提交的请求
+    void resubmit();
+
+    //准备各类请求
+    void prep_accept();
+    void prep_recv(int fd, unsigned int serial);
+    //暂停/恢复接收：暂存的数据达到上限时取消multishot recv，交给连接后再重新提交
+    void pause_recv(int fd);
+    void resume_recv(int fd);
+    void prep_poll(int fd, int op, bool multishot = true);
+    void prep_cancel(uint64_t user_data);
+    void prep_send(int fd);
+
+    //处理各类完成事件
+    void handle_cqe(struct io_uring_cqe *cqe);
+    void handle_accept(struct io_uring_cqe *cqe);
+    void handle_recv(struct io_uring_cqe *cqe);
+    void handle_send(struct io_uring_cqe *cqe);
+    void handle_completion();
+    //把数据交给连接并分发给工作线程，连接正在被处理时先暂存
+    //stalled表示工作线程刚处理完且未生成响应，此时读缓冲区仍放不下新数据说明单个请求超过上限
+    void feed(int fd, const char *data, int len, bool stalled = false);
+    void close_conn(int fd);
+    //user_data中保存的连接序号是否仍然有效
+    bool alive(int fd, unsigned int serial);
+
+private:
+    //user_data编码：高8位为请求类型，中间24位为连接序号，低32位为描述符
+    enum URING_OP
+    {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_SEND_HEADER,
+        OP_SEND_LAST,
+        OP_TIMER,
+        OP_SIGNAL,
+        OP_COMPLETION,
+        OP_BUFFER,
+        OP_UPGRADE
+    };
+    //连接在事件循环中的状态
+    enum CONN_STATE
+    {
+        CONN_IDLE = 0,      //等待请求数据
+        CONN_BUSY,          //工作线程正在处理
+        CONN_SENDING        //响应报文发送中
+    };
+    //连接上multishot recv的状态
+    enum RECV_STATE
+    {
+        RECV_ON = 0,        //已提交
+        RECV_CANCELLING,    //已提交取消，等待其最后一个完成事件
+        RECV_OFF            //已终止，恢复时重新提交
+    };
+
+    static const unsigned RING_ENTRIES = 1024;  //提交队列长度
+    static const unsigned BUF_ENTRIES = 1024;   //缓冲区组中缓冲区个数
+    static const unsigned BUF_SIZE = 4096;      //每个缓冲区大小
+    static const unsigned short BUF_GROUP = 0;  //缓冲区组号
+    static const size_t MAX_PENDING = 65536;    //每个连接暂存数据的上限，与连接读缓冲区的上限一致
+
+    WebServer *m_server;
+    int m_close_log;
+
+    //io_uring实例
+    int m_ring_fd;
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    struct io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_mask;
+    unsigned *m_sq_array;
+    unsigned m_sq_entries;
+    unsigned m_sqe_tail;        //本地维护的提交队列尾，submit时发布给内核
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned *m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    //缓冲区组
+    char *m_bufs;
+
+    //连接状态，下标为描述符
+    std::vector<char> m_state;
+    std::vector<char> m_close_pending;          //工作线程处理期间对端关闭，待完成后关闭
+    std::map<int, std::string> m_pending;       //工作线程处理期间收到的数据（如流水线请求）
+    std::vector<char> m_recv;                   //multishot recv的状态，下标为描述符
+    //提交队列满时未能提交的请求，下一轮事件循环开始时重新提交
+    std::vector<unsigned short> m_recycle_retry;            //未归还的缓冲区编号，不重试会永久减少缓冲区组中的缓冲区
+    std::vector<std::pair<int, unsigned int> > m_send_retry; //未提交发送的{描述符，连接序号}
+
+    completion_queue<http_conn> m_cq;           //工作线程完成通知
+    bool m_timeout;
+    bool m_stop;
+    bool m_accepting;                           //监听socket是否仍由本进程accept
+};
+
+#endif
@@ -0,0 +1,266 @@
+/*************************************************************
+* 请求解析微基准：比较逐字节的parse_line + strncasecmp链与http_scanner + 头部索引
+* 输入为几种典型浏览器请求，每轮把请求复制到缓冲区后完整解析一遍（与服务器一样会改写\r\n）
+* 用法：make parse_bench && ./parse_bench [轮数]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "../../http/http_scanner.h"
+
+static const char *requests[] = {
+    //Chrome打开页面
+    "GET /judge.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1700000000; session=8c1f0b7a9e2d4c6b\r\n"
+    "If-None-Match: \"ce807f-6ad47823-24a\"\r\n"
+    "If-Modified-Since: Sun, 18 Oct 2026 07:34:59 GMT\r\n"
+    "\r\n",
+    //Firefox加载图片
+    "GET /test1.jpg HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: image/avif,image/webp,*/*\r\n"
+    "Accept-Language: zh-CN,zh;q=0.8,zh-TW;q=0.7,zh-HK;q=0.5,en-US;q=0.3,en;q=0.2\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://127.0.0.1:9006/5\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "\r\n",
+    //登录表单提交（只解析到头部结束）
+    "POST /2CGISQL.cgi HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Length: 25\r\n"
+    "Origin: http://127.0.0.1:9006\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Referer: http://127.0.0.1:9006/1\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9\r\n"
+    "\r\n",
+    //视频拖动进度条
+    "GET /xxx.mp4 HTTP/1.1\r\n"
+    "Host: 127.0.0.1:9006\r\n"
+    "Connection: keep-alive\r\n"
+    "Accept-Encoding: identity;q=1, *;q=0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: */*\r\n"
+    "Referer: http://127.0.0.1:9006/6\r\n"
+    "Range: bytes=1048576-\r\n"
+    "If-Range: \"ce8121-6ad47829-1312d00\"\r\n"
+    "\r\n",
+};
+static const int REQUEST_NUM = sizeof(requests) / sizeof(requests[0]);
+
+//解析结果，防止编译器把解析过程优化掉
+struct parse_result
+{
+    int lines;
+    bool linger;
+    long content_length;
+    const char *host;
+    const char *range;
+};
+
+//原有实现：逐字节查找\r\n，请求头用strncasecmp链逐个比较
+static int old_parse_line(char *buf, int read_idx, int &checked_idx)
+{
+    for (; checked_idx < read_idx; ++checked_idx)
+    {
+        char temp = buf[checked_idx];
+        if (temp == '\r')
+        {
+            if (checked_idx + 1 == read_idx)
+                return 2;
+            if (buf[checked_idx + 1] == '\n')
+            {
+                buf[checked_idx++] = '\0';
+                buf[checked_idx++] = '\0';
+                return 0;
+            }
+            return 1;
+        }
+        else if (temp == '\n')
+        {
+            if (checked_idx > 1 && buf[checked_idx - 1] == '\r')
+            {
+                buf[checked_idx - 1] = '\0';
+                buf[checked_idx++] = '\0';
+                return 0;
+            }
+            return 1;
+        }
+    }
+    return 2;
+}
+
+static void old_parse(char *buf, int len, parse_result &res)
+{
+    int checked = 0, start = 0;
+    memset(&res, 0, sizeof(res));
+    while (old_parse_line(buf, len, checked) == 0)
+    {
+        char *text = buf + start;
+        start = checked;
+        if (res.lines++ == 0 || text[0] == '\0')
+            continue;
+        if (strncasecmp(text, "Connection:", 11) == 0)
+        {
+            text += 11;
+            text += strspn(text, " \t");
+            res.linger = strcasecmp(text, "keep-alive") == 0;
+        }
+        else if (strncasecmp(text, "Content-length:", 15) == 0)
+        {
+            text += 15;
+            text += strspn(text, " \t");
+            res.content_length = atol(text);
+        }
+        else if (strncasecmp(text, "Host:", 5) == 0)
+        {
+            text += 5;
+            res.host = text + strspn(text, " \t");
+        }
+        else if (strncasecmp(text, "Range:", 6) == 0)
+        {
+            text += 6;
+            res.range = text + strspn(text, " \t");
+        }
+    }
+}
+
+//新实现：http_scanner定位行结束符，请求头切分后记录到头部索引，只对需要的请求头按长度和名称比较
+struct header_field
+{
+    int name;
+    int name_len;
+    int value;
+};
+
+typedef const char *(*find_func)(const char *, const char *);
+
+static void new_parse(char *buf, int len, parse_result &res, find_func find)
+{
+    header_field headers[32];
+    int count = 0;
+    const char *end = buf + len;
+    char *line = buf;
+    memset(&res, 0, sizeof(res));
+    while (true)
+    {
+        char *eol = (char *)find(line, end);
+        if (eol + 1 >= end || eol[0] != '\r' || eol[1] != '\n')
+            break;
+        eol[0] = eol[1] = '\0';
+        char *text = line;
+        line = eol + 2;
+        if (res.lines++ == 0 || text[0] == '\0')
+            continue;
+        char *colon = strchr(text, ':');
+        if (!colon)
+            continue;
+        int name_len = colon - text;
+        char *value = colon + 1;
+        value += strspn(value, " \t");
+        if (count < 32)
+        {
+            headers[count].name = text - buf;
+            headers[count].name_len = name_len;
+            headers[count].value = value - buf;
+            ++count;
+        }
+        if (10 == name_len && strncasecmp(text, "Connection", 10) == 0)
+            res.linger = strcasecmp(value, "keep-alive") == 0;
+        else if (14 == name_len && strncasecmp(text, "Content-length", 14) == 0)
+            res.content_length = atol(value);
+        else if (4 == name_len && strncasecmp(text, "Host", 4) == 0)
+            res.host = value;
+    }
+    //与服务器一样，Range在生成响应时从头部索引查找
+    for (int i = 0; i < count; ++i)
+    {
+        if (5 == headers[i].name_len && strncasecmp(buf + headers[i].name, "Range", 5) == 0)
+        {
+            res.range = buf + headers[i].value;
+            break;
+        }
+    }
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//每轮解析全部请求，返回平均每个请求的耗时（纳秒）
+static double run(const char *name, int rounds, find_func find, long &checksum)
+{
+    char buf[REQUEST_NUM][4096];
+    int lens[REQUEST_NUM];
+    for (int i = 0; i < REQUEST_NUM; ++i)
+        lens[i] = strlen(requests[i]);
+
+    double start = now_ns();
+    for (int r = 0; r < rounds; ++r)
+    {
+        for (int i = 0; i < REQUEST_NUM; ++i)
+        {
+            memcpy(buf[i], requests[i], lens[i] + 1);
+            parse_result res;
+            if (find)
+                new_parse(buf[i], lens[i], res, find);
+            else
+                old_parse(buf[i], lens[i], res);
+            checksum += res.lines + res.linger + res.content_length + (res.host ? 1 : 0) + (res.range ? 1 : 0);
+        }
+    }
+    double ns = (now_ns() - start) / ((double)rounds * REQUEST_NUM);
+    printf("%-28s %8.1f ns/request\n", name, ns);
+    return ns;
+}
+
+int main(int argc, char *argv[])
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200000;
+    long checksum = 0;
+    printf("rounds: %d, requests: %d, runtime selection: %s\n", rounds, REQUEST_NUM, http_scanner::impl());
+
+    double base = run("parse_line (byte loop)", rounds, NULL, checksum);
+    double t = run("scanner scalar", rounds, http_scanner::find_eol_scalar, checksum);
+    printf("%-28s %8.2fx\n", "", base / t);
+    if (http_scanner::has_sse42())
+    {
+        t = run("scanner sse4.2", rounds, http_scanner::find_eol_sse42, checksum);
+        printf("%-28s %8.2fx\n", "", base / t);
+    }
+    if (http_scanner::has_avx2())
+    {
+        t = run("scanner avx2", rounds, http_scanner::find_eol_avx2, checksum);
+        printf("%-28s %8.2fx\n", "", base / t);
+    }
+    printf("checksum: %ld\n", checksum);
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*************************************************************
+* 慢速下载测试：按指定速率读取一个文件，检查服务器是否完整发送
+* 发送截止时间为宽限时间（10秒）加上已发送字节数按-g最低速率折算的时间，
+* 读取速率高于-g的客户端无论下载持续多久都不应被中途关闭，低于-g的则应被关闭
+* 用法：make slow_client && ./slow_client 端口 路径 速率(KB/s)
+* 例如服务器以-g 1000启动，./slow_client 9006 /big.bin 2500下载40MB文件约16秒，应完整收到
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        printf("usage: %s port path rate_kb\n", argv[0]);
+        return 2;
+    }
+    int port = atoi(argv[1]);
+    const char *path = argv[2];
+    double rate = atof(argv[3]) * 1024;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    //接收缓冲区较小时服务器的发送进度紧跟客户端的读取速率
+    int rcvbuf = 65536;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        return 2;
+    }
+    char request[512];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n", path);
+    if (send(fd, request, len, 0) != len)
+    {
+        perror("send");
+        return 2;
+    }
+
+    //头部之后的字节数与Content-Length比较
+    static char buf[65536];
+    char head[8192];
+    int head_len = 0;
+    long long content_length = -1, body = 0, total = 0;
+    double start = now();
+    while (true)
+    {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            break;
+        total += n;
+        if (content_length < 0)
+        {
+            int copy = n < (ssize_t)sizeof(head) - 1 - head_len ? n : sizeof(head) - 1 - head_len;
+            memcpy(head + head_len, buf, copy);
+            head_len += copy;
+            head[head_len] = '\0';
+            char *end = strstr(head, "\r\n\r\n");
+            if (end)
+            {
+                content_length = 0;
+                for (char *line = strstr(head, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n"))
+                {
+                    if (strncasecmp(line + 2, "Content-Length:", 15) == 0)
+                        content_length = atoll(line + 17);
+                }
+                body = total - (end + 4 - head);
+            }
+        }
+        else
+        {
+            body += n;
+        }
+        //按速率限速：读取超前时等待
+        double ahead = total / rate - (now() - start);
+        if (ahead > 0)
+            usleep(ahead * 1e6);
+    }
+    close(fd);
+
+    double elapsed = now() - start;
+    bool complete = content_length >= 0 && body == content_length;
+    printf("%s: %lld of %lld bytes in %.1fs (%.0f KB/s)\n", complete ? "complete" : "cut off", body, content_length,
+           elapsed, total / 1024.0 / elapsed);
+    return complete ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#ifndef COMPLETION_QUEUE_H
+#define COMPLETION_QUEUE_H
+
+#include <vector>
+#include <exception>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "../lock/locker.h"
+
+/*************************************************************
+* 完成队列：Reactor模式下工作线程向事件循环异步汇报任务完成情况
+* 工作线程完成读/写任务后push一条完成消息，事件循环通过epoll监听eventfd，就绪后一次性drain全部消息
+* 替代原来事件循环忙等improv/timer_flag的做法，事件循环无需等待工作线程，可以同时分发多个任务
+**************************************************************/
+
+template <typename T>
+class completion_queue
+{
+public:
+    //完成消息
+    struct completion
+    {
+        T *request;             //完成的任务对象
+        unsigned int serial;    //任务对象被分配给当前连接时的序号，用于丢弃连接已被关闭、复用后的过期消息
+        bool close;             //是否需要关闭连接（读写失败）
+        bool idle;              //任务结束时连接是否为空闲长连接，在重新注册事件之前记录
+    };
+
+    completion_queue()
+    {
+        m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_eventfd == -1)
+        {
+            throw std::exception();
+        }
+    }
+    ~completion_queue()
+    {
+        close(m_eventfd);
+    }
+
+    //事件循环将该描述符注册到内核事件表
+    int get_fd()
+    {
+        return m_eventfd;
+    }
+
+    //工作线程调用：添加完成消息
+    //只有队列由空变为非空时才写eventfd，事件循环来不及处理时多条消息只唤醒一次
+    void push(T *request, unsigned int serial, bool close, bool idle = false)
+    {
+        completion c;
+        c.request = request;
+        c.serial = serial;
+        c.close = close;
+        c.idle = idle;
+
+        m_lock.lock();
+        bool notify = m_queue.empty();
+        m_queue.push_back(c);
+        m_lock.unlock();
+
+        if (notify)
+        {
+            uint64_t one = 1;
+            ::write(m_eventfd, &one, sizeof(one));
+        }
+    }
+
+    //事件循环调用：取出全部完成消息
+    void drain(std::vector<completion> &out)
+    {
+        uint64_t count;
+        ::read(m_eventfd, &count, sizeof(count));
+
+        out.clear();
+        m_lock.lock();
+        out.swap(m_queue);
+        m_lock.unlock();
+    }
+
+private:
+    int m_eventfd;
+    locker m_lock;
+    std::vector<completion> m_queue;
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include<pthread.h>
 #include"../lock/locker.h"
 #include "../CGImysql/sql_connection_pool.h"
+#include "completion_queue.h"
 
 
 /*问题
@@ -162,35 +163,48 @@ void threadpool<T>::run(){
 
         //根据不同的事件处理模式进行操作
         if(1 == m_actor_model){     //Reactor
+            //读写完成后通过完成队列异步通知事件循环，读写失败则由事件循环关闭连接
+            unsigned int serial = request->get_serial();
             //0-读
             if(0 == request->m_state){
                 if(request->read_once()){
-                    request->improv = 1;
                     //从连接池中取出一个数据库连接
                     //这里做了RAII优化，对象销毁时自动调用析构函数并将sql连接放回连接池
                     connectionRAII mysqlcon(&request->mysql, m_connPool);
                     //process(模板类中的方法,这里是http类)进行处理
-                    request->process();
+                    bool ok = request->process();
+                    request->m_cq->push(request, serial, !ok);
                 }
                 else{
-                    request->improv = 1;
-                    request->timer_flag = 1;
+                    request->m_cq->push(request, serial, true);
                 }
             }
             //1-写
+            //write重新注册事件后连接可能已被其它工作线程处理，只根据其返回的去向决定后续操作
             else{
-                if(request->write()){
-                    request->improv = 1;
-                }
-                else{
-                    request->improv = 1;
-                    request->timer_flag = 1;
+                typename T::WRITE_END end;
+                bool ok = request->write(&end);
+                //读缓冲区中还有流水线请求，直接继续处理
+                if(ok && T::WRITE_PIPELINE == end){
+                    connectionRAII mysqlcon(&request->mysql, m_connPool);
+                    ok = request->process();
                 }
+                request->m_cq->push(request, serial, !ok, ok && T::WRITE_IDLE == end);
             }
         }
         else{                       //Proactor
-            connectionRAII mysqlcon(&request->mysql, m_connPool);
-            request->process();
+            unsigned int serial = request->get_serial();
+            completion_queue<T> *cq = request->m_cq;
+            bool ok;
+            {
+                connectionRAII mysqlcon(&request->mysql, m_connPool);
+                ok = request->process();
+            }
+            //io_uring后端由事件循环负责发送，需要通知其处理结果
+            //epoll下由工作线程自行注册写事件，仍需通知完成：连接在处理期间关闭时，事件循环等完成后才归还连接对象
+            if(cq){
+                cq->push(request, serial, !ok);
+            }
         }
     }
 }
@@ -1,12 +1,23 @@
 #include "lst_timer.h"
 #include "../http/http_conn.h"
+#include "../http/conn_registry.h"
 
 
+long long time_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 /*------------------------sort_timer_lst----------------------------------*/
 sort_timer_lst::sort_timer_lst()
 {
     head = NULL;
     tail = NULL;
+    idle_head = NULL;
+    idle_tail = NULL;
+    m_idle_count = 0;
 }
 //析构，负责销毁链表
 sort_timer_lst::~sort_timer_lst()
@@ -45,31 +56,34 @@ void sort_timer_lst::adjust_timer(util_timer *timer)
     {
         return;
     }
-    util_timer *tmp = timer->next;
-
-    //注意：这一部分是否可以通过虚拟头节点统一处理？
-
-    //情况1：被调整定时器在链表尾部，或超时时间仍小于下一个定时器超时值，无需调整
-    //在尾部无需调整，是因为调整定时器都是因为需要更新超时时间，会变得比原来更大
-    if (!tmp || timer->expire < tmp->expire)
+    //情况1：超时时间仍在前后两个定时器之间，无需调整
+    if ((!timer->prev || timer->prev->expire <= timer->expire) &&
+        (!timer->next || timer->expire < timer->next->expire))
     {
         return;
     }
-    //情况2：被调整定时器在链表头部，则将该定时器取出，并重新插入
-    if (timer == head)
-    {
-        head = head->next;
-        head->prev = NULL;
-        timer->next = NULL;
-        add_timer(timer, head);
-    }
-    //情况3：被调整定时器在内部，则将定时器取出，并重新插入
+    //情况2：取出该定时器后重新插入
+    //超时时间变大时从原位置之后查找插入位置，变小时从头节点开始查找
+    util_timer *after = timer->next;
+    bool later = after && timer->expire >= after->expire;
+    unlink(timer);
+    if (later)
+        add_timer(timer, after);
     else
-    {
+        add_timer(timer);
+}
+//从链表中取出定时器，不释放
+void sort_timer_lst::unlink(util_timer *timer)
+{
+    if (timer->prev)
         timer->prev->next = timer->next;
+    else
+        head = timer->next;
+    if (timer->next)
         timer->next->prev = timer->prev;
-        add_timer(timer, timer->next);
-    }
+    else
+        tail = timer->prev;
+    timer->prev = timer->next = NULL;
 }
 //将到期的定时器从链表中删除
 void sort_timer_lst::del_timer(util_timer *timer)
@@ -78,6 +92,7 @@ void sort_timer_lst::del_timer(util_timer *timer)
     {
         return;
     }
+    set_idle(timer, false);
     //链表中只有一个定时器，需要删除该定时器
     if ((timer == head) && (timer == tail))
     {
@@ -108,7 +123,7 @@ void sort_timer_lst::del_timer(util_timer *timer)
     delete timer;
 }
 //定时任务处理函数
-//说明：SIGALRM信号每次被触发，主循环中调用一次定时任务处理函数，处理链表容器中到期的定时器
+//说明：timerfd每次到期，事件循环中调用一次定时任务处理函数，处理链表容器中到期的定时器
 //1.遍历定时器升序链表容器，从头结点开始依次处理每个定时器，直到遇到尚未到期的定时器
 //2.若当前时间小于定时器超时时间，跳出循环，即未找到到期的定时器
 //3.若当前时间大于定时器超时时间，即找到了到期的定时器，执行回调函数，然后将它从链表中删除，然后继续遍历
@@ -120,7 +135,7 @@ void sort_timer_lst::tick()
         return;
     }
     //获取当前时间
-    time_t cur = time(NULL);
+    long long cur = time_ms();
     util_timer *tmp = head;
     //遍历定时器链表
     while (tmp != NULL)
@@ -131,7 +146,17 @@ void sort_timer_lst::tick()
         {
             break;
         }
+        //连接在定时器设置之后进入了新的阶段或有了发送进展，截止时间已推迟，按新的截止时间重新排序
+        long long deadline = tmp->user_data->deadline.load(std::memory_order_relaxed);
+        if (deadline > cur)
+        {
+            tmp->expire = deadline;
+            adjust_timer(tmp);
+            tmp = head;
+            continue;
+        }
         //若当前定时器到期，则调用回调函数，执行定时事件（清理非活动连接）
+        set_idle(tmp, false);
         tmp->cb_func(tmp->user_data);
         //将处理后的定时器从容器中删除，并重置头节点
         //不能直接调用del_timer，因为这里还需要head，之前的设计不能适配这里的需求，除非令del_timer的返回值为head
@@ -144,6 +169,47 @@ void sort_timer_lst::tick()
         tmp = head;
     }
 }
+//加入空闲链表时放到尾部，离开空闲时取出
+void sort_timer_lst::set_idle(util_timer *timer, bool idle)
+{
+    if (timer->idle == idle)
+        return;
+    timer->idle = idle;
+    if (idle)
+    {
+        timer->idle_prev = idle_tail;
+        timer->idle_next = NULL;
+        if (idle_tail)
+            idle_tail->idle_next = timer;
+        else
+            idle_head = timer;
+        idle_tail = timer;
+        ++m_idle_count;
+        return;
+    }
+    if (timer->idle_prev)
+        timer->idle_prev->idle_next = timer->idle_next;
+    else
+        idle_head = timer->idle_next;
+    if (timer->idle_next)
+        timer->idle_next->idle_prev = timer->idle_prev;
+    else
+        idle_tail = timer->idle_prev;
+    timer->idle_prev = timer->idle_next = NULL;
+    --m_idle_count;
+}
+//只shutdown而不直接关闭：对端收到FIN，事件循环随后收到挂断事件，按常规流程关闭连接并删除定时器
+//同一轮事件中可能还有该连接的事件，此时连接对象和描述符都不能被归还复用
+bool sort_timer_lst::evict_idle()
+{
+    util_timer *timer = idle_head;
+    if (!timer)
+        return false;
+    set_idle(timer, false);
+    shutdown(timer->user_data->sockfd, SHUT_RDWR);
+    http_conn::m_idle_evictions.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
 //私有add_timer函数，常规添加节点函数，用于调整链表内部（非head/tail）节点
 void sort_timer_lst::add_timer(util_timer *timer, util_timer *lst_head)
 {
@@ -178,9 +244,10 @@ void sort_timer_lst::add_timer(util_timer *timer, util_timer *lst_head)
 
 /*------------------------Utils----------------------------------*/
 
-void Utils::init(int timeslot)
+void Utils::init(int tick_ms, int busy_poll_us)
 {
-    m_TIMESLOT = timeslot;
+    m_tick_ms = tick_ms;
+    m_busy_poll_us = busy_poll_us;
 }
 //对文件描述符设置非阻塞
 int Utils::setnonblocking(int fd)
@@ -191,10 +258,10 @@ int Utils::setnonblocking(int fd)
     return old_option;
 }
 //将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
+void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode, void *ptr)
 {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.ptr = ptr;
     
     if (1 == TRIGMode)
         event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
@@ -208,19 +275,6 @@ void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode)
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
     setnonblocking(fd);
 }
-//信号处理函数
-//信号处理函数中仅仅通过管道发送信号值，不处理信号对应的逻辑，缩短异步执行时间，减少对主程序的影响。
-void Utils::sig_handler(int sig)
-{
-    //为保证函数的可重入性，保留原来的errno
-    //可重入性表示中断后再次进入该函数，环境变量与之前相同，不会丢失数据
-    int save_errno = errno;
-    int msg = sig;
-    //将信号值从管道写端写入，传输字符类型，而非整型
-    send(u_pipefd[1], (char *)&msg, 1, 0);
-    //将原来的errno赋值为当前的errno
-    errno = save_errno;
-}
 //设置信号函数
 void Utils::addsig(int sig, void(handler)(int), bool restart)
 {
@@ -236,12 +290,56 @@ void Utils::addsig(int sig, void(handler)(int), bool restart)
     //执行sigaction函数
     assert(sigaction(sig, &sa, NULL) != -1);
 }
-//定时处理任务，重新定时以不断触发SIGALRM信号
+//创建周期性timerfd，由epoll直接监听，取代alarm + SIGALRM + 管道的通知方式
+//支持毫秒级周期，超时连接可以被及时、均匀地清理，而不是每隔数秒集中处理一次
+int Utils::create_tickfd()
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    assert(fd != -1);
+    struct itimerspec its;
+    its.it_value.tv_sec = m_tick_ms / 1000;
+    its.it_value.tv_nsec = (m_tick_ms % 1000) * 1000000L;
+    its.it_interval = its.it_value;
+    timerfd_settime(fd, 0, &its, NULL);
+    return fd;
+}
+//等待就绪事件
+//阻塞的epoll_wait被唤醒需要经历一次调度，忙轮询以CPU换取尾延迟
+int Utils::wait_events(int epollfd, epoll_event *events, int max_events)
+{
+    if (m_busy_poll_us > 0)
+    {
+        struct timespec start, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (true)
+        {
+            int number = epoll_wait(epollfd, events, max_events, 0);
+            if (number != 0)
+                return number;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long long elapsed = (long long)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+            if (elapsed >= m_busy_poll_us)
+                break;
+        }
+    }
+    return epoll_wait(epollfd, events, max_events, -1);
+}
+//设置socket忙轮询
+//超过net.core.busy_read的取值需要CAP_NET_ADMIN权限，设置失败时仅退化为普通读取，忽略错误
+void Utils::set_busy_poll(int fd)
+{
+    if (m_busy_poll_us <= 0)
+        return;
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &m_busy_poll_us, sizeof(m_busy_poll_us));
+#ifdef SO_PREFER_BUSY_POLL
+    int flag = 1;
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &flag, sizeof(flag));
+#endif
+}
+//定时处理任务
 void Utils::timer_handler()
 {
     m_timer_lst.tick();
-    //设置信号传送闹钟，即用来设置信号SIGALRM在经过参数m_TIMESLOT秒数后发送给目前的进程
-    alarm(m_TIMESLOT);
 }
 //显示错误信息
 void Utils::show_error(int connfd, const char *info)
@@ -251,7 +349,6 @@ void Utils::show_error(int connfd, const char *info)
 }
 
 //静态成员遍历初始化
-int *Utils::u_pipefd = 0;
 int Utils::u_epollfd = 0;
 
 /*-------------------------------------------------------------------*/
@@ -260,10 +357,38 @@ int Utils::u_epollfd = 0;
 class Utils;
 void cb_func(client_data *user_data)
 {
-    epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     //断言以检测指针user_data是否合法，防止后面使用指针时出现异常
     assert(user_data);      
-    close(user_data->sockfd);
+    int sockfd = user_data->sockfd;
+    //从连接所属Reactor的内核事件表中删除
+    if (user_data->epollfd != -1)
+        epoll_ctl(user_data->epollfd, EPOLL_CTL_DEL, sockfd, 0);
+    //io_uring后端：未完成的multishot recv持有socket引用，仅close不会真正关闭连接，先shutdown使其结束
+    else
+        shutdown(sockfd, SHUT_RDWR);
+    //定时器由调用方删除，这里清空指针，表示连接已关闭
+    user_data->timer = NULL;
+    //工作线程仍在处理该连接时，连接对象和读写缓冲区还在使用，不能归还
+    //先shutdown使其读写尽快失败，收到最后一个完成消息后再归还
+    if (user_data->tasks > 0)
+    {
+        shutdown(sockfd, SHUT_RDWR);
+        user_data->closing = true;
+        return;
+    }
+    release_conn(user_data);
+}
+
+void release_conn(client_data *user_data)
+{
+    int sockfd = user_data->sockfd;
+    user_data->closing = false;
+    //连接占用的缓冲区、文件缓存引用和上传的临时文件随连接一起释放，不等连接对象被复用
+    user_data->conn->release_resources();
+    //归还连接对象，之后user_data可能被其它线程的新连接复用，不能再访问
+    //必须在close之前归还，否则描述符可能先被新连接复用
+    conn_registry::get_instance()->release(user_data->conn, sockfd);
+    close(sockfd);
     http_conn::m_user_count--;
 }
 
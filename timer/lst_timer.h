@@ -20,13 +20,18 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
 
 #include <time.h>
+#include <atomic>
 #include "../log/log.h"
 
-//连接资源结构体成员需要用到定时器类
+//连接资源结构体成员需要用到定时器类和定时器容器类
 //需要前向声明
 class util_timer;
+class sort_timer_lst;
+class http_conn;
 
 //连接资源
 struct client_data
@@ -37,21 +42,39 @@ struct client_data
     int sockfd;
     //定时器
     util_timer *timer;
+    //连接所属Reactor的内核事件表（多Reactor模式下各子Reactor不同）
+    int epollfd;
+    //连接所属Reactor的定时器容器
+    sort_timer_lst *timer_lst;
+    //连接资源所在的连接对象，关闭连接时归还给连接注册表
+    http_conn *conn;
+    //连接当前阶段（接收头部、接收消息体、发送响应、长连接空闲）的截止时间（毫秒，单调时钟）
+    //由处理该连接的线程在阶段切换和发送进展时更新，事件循环据此设置定时器
+    std::atomic<long long> deadline;
+    //已分发给工作线程、尚未收到完成消息的任务数，以及io_uring后端尚未完成的发送，只由事件循环访问
+    int tasks;
+    //连接已关闭，但仍有工作线程持有，等全部完成消息到达后再归还连接对象和描述符
+    bool closing;
 };
 
+//单调时钟的当前时间（毫秒），定时器的超时时间均以此为准，不受系统时间调整影响
+long long time_ms();
+
 //定时回调函数
 //定时事件/任务：用于当处理异常事件或定时器到期时，从内核事件表删除事件，关闭文件描述符，释放连接资源
 void cb_func(client_data *user_data);
+//工作线程全部完成后归还连接对象并关闭描述符，cb_func和完成消息的处理中调用
+void release_conn(client_data *user_data);
 
 //定时器类
 class util_timer
 {
 public:
-    util_timer() : prev(NULL), next(NULL) {}
+    util_timer() : prev(NULL), next(NULL), idle(false), idle_prev(NULL), idle_next(NULL) {}
 
 public:
-    //超时时间，expire = 浏览器和服务器连接时刻(绝对时间) + 固定时间(TIMESLOT)
-    time_t expire;
+    //超时时间（毫秒，单调时钟），取自连接当前阶段的截止时间user_data->deadline
+    long long expire;
     //回调函数
     void (* cb_func)(client_data *);
     //连接资源
@@ -60,6 +83,10 @@ public:
     util_timer *prev;
     //后继定时器
     util_timer *next;
+    //连接是否为空闲的长连接，以及在空闲LRU链表中的前后节点
+    bool idle;
+    util_timer *idle_prev;
+    util_timer *idle_next;
 };
 
 //定时器容器类（带头尾节点的双向升序链表）
@@ -73,18 +100,33 @@ public:
     //添加定时器，内部调用私有成员add_timer
     void add_timer(util_timer *timer);
     //调整定时器，任务发生变化时，调整定时器在链表中的位置，内部调用私有成员add_timer
+    //超时时间可能变大也可能变小（如从接收消息体切换到长连接空闲）
     void adjust_timer(util_timer *timer);
     //将到期的定时器从链表中删除
     void del_timer(util_timer *timer);
     //定时任务处理函数
     void tick();
 
+    //空闲的长连接按进入空闲的先后另外组成LRU链表，头部为空闲最久的连接
+    void set_idle(util_timer *timer, bool idle);
+    //淘汰空闲最久的长连接，没有空闲连接时返回false
+    bool evict_idle();
+    int idle_count() const
+    {
+        return m_idle_count;
+    }
+
 private:
     //私有成员，被公有成员add_timer和adjust_time调用（设置为私有成员的原因，方便复用代码，调整链表内部结点）
     void add_timer(util_timer *timer, util_timer *lst_head);
+    //从链表中取出定时器，不释放
+    void unlink(util_timer *timer);
 
     util_timer *head;
     util_timer *tail;
+    util_timer *idle_head;
+    util_timer *idle_tail;
+    int m_idle_count;
 };
 
 class Utils
@@ -93,7 +135,7 @@ public:
     Utils() {}
     ~Utils() {}
 
-    void init(int timeslot);
+    void init(int tick_ms, int busy_poll_us);
 
     //对文件描述符设置非阻塞
     /*问题：为什么要设置为非阻塞？
@@ -102,25 +144,32 @@ public:
     int setnonblocking(int fd);
 
     //将内核事件表注册读事件，ET模式，并开启EPOLLONESHOT
-    void addfd(int epollfd, int fd, bool one_shot, int TRIGMode);
+    //ptr作为epoll_event.data.ptr，事件循环据此区分就绪的描述符
+    void addfd(int epollfd, int fd, bool one_shot, int TRIGMode, void *ptr);
     
-    //信号处理函数
-    static void sig_handler(int sig);
-
     //设置信号函数
     void addsig(int sig, void(handler)(int), bool restart = true);
 
-    //定时处理任务，重新定时以不断触发SIGALRM信号
+    //创建周期为m_tick_ms毫秒的timerfd，每个Reactor各自注册一个
+    int create_tickfd();
+
+    //等待就绪事件，开启忙轮询时先以零超时反复检查m_busy_poll_us微秒，仍无事件再阻塞
+    int wait_events(int epollfd, epoll_event *events, int max_events);
+
+    //开启忙轮询时为socket设置SO_BUSY_POLL/SO_PREFER_BUSY_POLL，由内核在读取时轮询网卡队列
+    void set_busy_poll(int fd);
+
+    //定时处理任务，处理定时器链表上的超时连接
     void timer_handler();
 
     //显示错误信息
     void show_error(int connfd, const char *info);
 
 public:
-    static int *u_pipefd;    //信号处理函数到主线程的管道的文件描述符
     sort_timer_lst m_timer_lst;
     static int u_epollfd;    //统一事件源，用于监听信号事件的内核事件表文件描述符
-    int m_TIMESLOT;
+    int m_tick_ms;           //定时器链表的检查周期（毫秒）
+    int m_busy_poll_us;      //忙轮询时长（微秒），0表示关闭
 };
 
 #endif
\ No newline at end of file
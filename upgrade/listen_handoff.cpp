@@ -0,0 +1,149 @@
+#include "listen_handoff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+
+extern char **environ;
+
+//新进程通过该环境变量得知交接socket的描述符
+static const char *HANDOFF_ENV = "WEBSERVER_HANDOFF_FD";
+
+int listen_handoff::s_sock = -1;
+
+int listen_handoff::spawn(const int *fds, int n, pid_t &pid)
+{
+    if (n <= 0 || n > MAX_FDS)
+        return -1;
+
+    //新进程沿用当前的命令行参数，argv[0]按原样执行，从而执行磁盘上替换后的程序
+    std::string cmdline;
+    FILE *fp = fopen("/proc/self/cmdline", "re");
+    if (!fp)
+        return -1;
+    char buf[4096];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+        cmdline.append(buf, len);
+    fclose(fp);
+    std::vector<char *> argv;
+    for (size_t i = 0; i < cmdline.size(); i += strlen(&cmdline[i]) + 1)
+        argv.push_back(&cmdline[i]);
+    if (argv.empty())
+        return -1;
+    argv.push_back(NULL);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+        return -1;
+
+    //fork之后到exec之前只能调用异步信号安全的函数，环境变量提前准备好
+    char handoff[64];
+    snprintf(handoff, sizeof(handoff), "%s=%d", HANDOFF_ENV, sv[1]);
+    std::vector<char *> envp;
+    for (char **env = environ; *env; ++env)
+    {
+        if (strncmp(*env, HANDOFF_ENV, strlen(HANDOFF_ENV)) != 0)
+            envp.push_back(*env);
+    }
+    envp.push_back(handoff);
+    envp.push_back(NULL);
+
+    //监听socket在fork之前写入交接socket，新进程启动后即可读取
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    memset(control, 0, sizeof(control));
+    struct iovec iov;
+    iov.iov_base = &n;
+    iov.iov_len = sizeof(n);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n);
+    if (sendmsg(sv[0], &msg, 0) < 0)
+    {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    pid = fork();
+    if (pid < 0)
+    {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (0 == pid)
+    {
+        //子进程：只保留交接socket，其余描述符在exec时关闭
+        fcntl(sv[1], F_SETFD, 0);
+        execvpe(argv[0], &argv[0], &envp[0]);
+        _exit(127);
+    }
+
+    close(sv[1]);
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    return sv[0];
+}
+
+int listen_handoff::inherit(int *fds, int max)
+{
+    const char *env = getenv(HANDOFF_ENV);
+    if (!env)
+        return 0;
+    s_sock = atoi(env);
+    unsetenv(HANDOFF_ENV);
+    fcntl(s_sock, F_SETFD, FD_CLOEXEC);
+
+    //旧进程在fork之前已写入，阻塞读取即可
+    int n = 0;
+    char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+    struct iovec iov;
+    iov.iov_base = &n;
+    iov.iov_len = sizeof(n);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(s_sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(n))
+        return 0;
+
+    int count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int *data = (int *)CMSG_DATA(cmsg);
+        for (int i = 0; i < num; ++i)
+        {
+            if (count < max)
+                fds[count++] = data[i];
+            else
+                close(data[i]);
+        }
+    }
+    return count;
+}
+
+void listen_handoff::ready()
+{
+    if (s_sock == -1)
+        return;
+    char ok = 1;
+    if (write(s_sock, &ok, 1) != 1)
+        perror("handoff ready");
+    close(s_sock);
+    s_sock = -1;
+}
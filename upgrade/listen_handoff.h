@@ -0,0 +1,33 @@
+#ifndef LISTEN_HANDOFF_H
+#define LISTEN_HANDOFF_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*************************************************************
+* 监听socket交接：收到SIGUSR2时平滑升级，部署期间不拒绝连接
+* 1.旧进程fork并exec磁盘上的新版本程序（命令行参数不变），通过UNIX域socket以SCM_RIGHTS传递监听socket
+* 2.新进程直接使用继承的监听socket（监听队列中尚未accept的连接也随之保留），就绪后回复一个字节
+* 3.旧进程收到就绪通知后停止accept，已有连接处理完当前请求后关闭，全部关闭或超时后退出
+* 新进程启动失败（交接socket被关闭）时旧进程继续正常服务
+**************************************************************/
+
+class listen_handoff
+{
+public:
+    //旧进程：传递fds中的n个监听socket并启动新进程，返回与新进程通信的描述符（非阻塞），失败返回-1
+    static int spawn(const int *fds, int n, pid_t &pid);
+    //新进程：若由旧进程启动，将继承的监听socket存入fds并返回个数，否则返回0
+    static int inherit(int *fds, int max);
+    //新进程：监听socket已全部注册，通知旧进程停止accept
+    static void ready();
+
+public:
+    static const int MAX_FDS = 64;  //最多交接的监听socket个数
+
+private:
+    static int s_sock;              //新进程中与旧进程通信的描述符
+};
+
+#endif
@@ -2,8 +2,8 @@
 
 WebServer::WebServer()
 {
-    //http_conn类对象
-    users = new http_conn[MAX_FD];
+    //http_conn类对象在accept时由连接注册表按需分配
+    conn_registry::get_instance()->init(MAX_FD);
 
     //root文件夹路径
     char server_path[200];
@@ -13,23 +13,45 @@ WebServer::WebServer()
     strcpy(m_root, server_path);
     strcat(m_root, root);
 
-    //定时器
-    users_timer = new client_data[MAX_FD];
+    //子Reactor和io_uring事件循环在eventListen中按需创建
+    m_reactors = NULL;
+    m_uring = NULL;
+    m_reactor_num = 0;
+    m_next_reactor = 0;
+    m_timerfd = -1;
+    m_signalfd = -1;
+    m_idlefd = -1;
+    m_upgradefd = -1;
+    m_upgrade_pid = -1;
+    m_draining = false;
+    m_drain_deadline = 0;
+    m_max_conn = MAX_FD;
+    m_max_idle = 0;
+    m_loop_idle = 0;
 }
 
 WebServer::~WebServer()
 {
+    //先回收子Reactor线程
+    delete[] m_reactors;
+    delete m_uring;
     close(m_epollfd);
     close(m_listenfd);
-    close(m_pipefd[1]);
-    close(m_pipefd[0]);
-    delete[] users;
-    delete[] users_timer;
+    close(m_timerfd);
+    close(m_signalfd);
+    if (m_idlefd != -1)
+        close(m_idlefd);
+    if (m_upgradefd != -1)
+        close(m_upgradefd);
     delete m_pool;
 }
 
 void WebServer::init(int port, string user, string passWord, string databaseName, int log_write, 
-                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model)
+                     int opt_linger, int trigmode, int sql_num, int thread_num, int close_log, int actor_model, int reactor_num,
+                     int reuseport, int backlog, int io_backend, int tick_ms, int busy_poll,
+                     string cache_control, int max_body, int write_quota,
+                     int header_timeout, int body_timeout, int idle_timeout, int min_send_rate,
+                     int max_requests, int max_idle)
 {
     m_port = port;
     m_user = user;
@@ -41,7 +63,50 @@ void WebServer::init(int port, string user, string passWord, string databaseName
     m_OPT_LINGER = opt_linger;
     m_TRIGMode = trigmode;
     m_close_log = close_log;
-    m_actormodel = actor_model;
+    //io_uring后端本身就是Proactor模式，数据收发由内核完成，忽略并发模型参数
+    m_actormodel = (1 == io_backend) ? 0 : actor_model;
+    m_reactor_num = reactor_num;
+    m_reuseport = reuseport;
+    m_backlog = backlog;
+    m_io_backend = io_backend;
+    m_tick_ms = tick_ms;
+    m_busy_poll = busy_poll;
+    //Cache-Control策略为所有连接共享
+    http_conn::init_cache_control(cache_control);
+    http_conn::init_routes();
+    http_conn::m_max_body = (long long)max_body << 20;
+    http_conn::m_write_quota = (long long)write_quota << 10;
+    http_conn::m_header_timeout = header_timeout * 1000;
+    http_conn::m_body_timeout = body_timeout * 1000;
+    http_conn::m_idle_timeout = idle_timeout * 1000;
+    http_conn::m_min_send_rate = (long long)min_send_rate << 10;
+    http_conn::m_max_requests = max_requests;
+    m_max_idle = max_idle;
+
+    //连接数上限：每个连接占用一个描述符，按文件描述符上限扣除预留部分、上传和文件缓存占用的描述符
+    //描述符不足时文件缓存最多使用剩余部分的四分之一，其余留给连接
+    m_max_conn = MAX_FD;
+    struct rlimit rl;
+    long long others = FD_RESERVE + http_conn::MAX_UPLOADS * http_conn::UPLOAD_FDS;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+        rl.rlim_cur < (rlim_t)(MAX_FD + others + file_cache::MAX_ENTRIES))
+    {
+        long long avail = (long long)rl.rlim_cur > 2 * others ? (long long)rl.rlim_cur - others : rl.rlim_cur / 2;
+        int entries = file_cache::MAX_ENTRIES;
+        if (entries > avail / 4)
+            entries = avail / 4 > 1 ? avail / 4 : 1;
+        file_cache::get_instance()->set_max_entries(entries);
+        m_max_conn = avail - entries < MAX_FD ? avail - entries : MAX_FD;
+    }
+    http_conn::m_busy_conns = (long long)m_max_conn * BUSY_PERCENT / 100;
+
+    //SIGTERM和SIGUSR2改由signalfd读取，必须在所有线程中屏蔽，否则可能被投递给其他线程执行默认动作
+    //线程继承创建者的信号掩码，因此在创建日志、数据库连接池和线程池的线程之前设置
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
 }
 
 void WebServer::trig_mode()
@@ -91,7 +156,7 @@ void WebServer::sql_pool()
     m_connPool->init("localhost", m_user, m_passWord, m_databaseName, 3306, m_sql_num, m_close_log);
 
     //初始化数据库读取表
-    users->initmysql_result(m_connPool);
+    http_conn::initmysql_result(m_connPool, m_close_log);
 }
 
 void WebServer::thread_pool()
@@ -100,29 +165,24 @@ void WebServer::thread_pool()
     m_pool = new threadpool<http_conn>(m_actormodel, m_connPool, m_thread_num);
 }
 
-void WebServer::eventListen()
+//创建一个监听socket，reuseport为true时开启SO_REUSEPORT，多个socket可绑定同一端口，由内核在它们之间分配新连接
+int WebServer::openListenfd(bool reuseport)
 {
-    /*网络编程基础步骤
-    * 1.创建socket
-    * 2.socket命名，及绑定socket地址
-    * 3.创建socket监听队列
-    * 4.创建epoll内核事件表
-    */
-
     //1.创建socket
-    m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
+    //监听socket设为非阻塞，批量accept直到监听队列为空
+    int listenfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    assert(listenfd >= 0);
 
     //优雅关闭连接
     if (0 == m_OPT_LINGER)
     {
         struct linger tmp = {0, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
     else if (1 == m_OPT_LINGER)
     {
         struct linger tmp = {1, 1};
-        setsockopt(m_listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
+        setsockopt(listenfd, SOL_SOCKET, SO_LINGER, &tmp, sizeof(tmp));
     }
 
     int ret = 0;
@@ -133,21 +193,67 @@ void WebServer::eventListen()
     address.sin_port = htons(m_port);
 
     int flag = 1;
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    //SO_REUSEPORT必须在bind之前设置，且同一端口上的所有socket都要设置
+    if (reuseport)
+    {
+        ret = setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+        assert(ret >= 0);
+    }
     //2.socket命名
     //只有命名后客户端才能知道该如何连接它（IP、port设置和绑定）
-    //bind将addresss所指的socket地址分配给未命名的sockfd文件描述符m_listenfd
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+    //bind将addresss所指的socket地址分配给未命名的sockfd文件描述符listenfd
+    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret >= 0);
 
     //3.创建一个监听队列以存放待处理的客户连接
 
-    //m_listenfd指定被监听的socket，5表示内核监听队列的最大长度(处于完全连接状态ESTABLISH的连接数量上限)
-    //监听队列的长度超过5则服务器将不受理新的客户连接，客户端也将收到ECONNREFUSED错误信息
-    ret = listen(m_listenfd, 5);
+    //listenfd指定被监听的socket，m_backlog表示内核监听队列的最大长度(处于完全连接状态ESTABLISH的连接数量上限)
+    //监听队列满时新的SYN会被丢弃，客户端只能超时重传，因此连接风暴下需要足够大的backlog（实际上限还受net.core.somaxconn限制）
+    ret = listen(listenfd, m_backlog);
     assert(ret >= 0);
+    utils.set_busy_poll(listenfd);
+
+    return listenfd;
+}
+
+void WebServer::eventListen()
+{
+    /*网络编程基础步骤
+    * 1.创建socket
+    * 2.socket命名，及绑定socket地址
+    * 3.创建socket监听队列
+    * 4.创建epoll内核事件表
+    */
 
-    utils.init(TIMESLOT);
+    //io_uring后端：由主线程的io_uring事件循环代替epoll处理所有连接，此时不使用子Reactor
+    m_uring = NULL;
+    if (1 == m_io_backend)
+    {
+        m_uring = new uring_proactor;
+        if (!m_uring->init(this, m_close_log))
+        {
+            LOG_ERROR("%s", "io_uring unavailable, fall back to epoll");
+            delete m_uring;
+            m_uring = NULL;
+        }
+    }
+
+    utils.init(m_tick_ms, m_busy_poll);
+
+    //由旧进程平滑升级启动时，优先使用继承的监听socket
+    int inherited[listen_handoff::MAX_FDS];
+    int inherited_num = listen_handoff::inherit(inherited, listen_handoff::MAX_FDS);
+    m_inherited.assign(inherited, inherited + inherited_num);
+
+    //1~3.创建监听socket
+    //SO_REUSEPORT分片模式：每个子Reactor拥有自己的监听socket并自行accept，主线程不再监听
+    bool sharded = m_reuseport && m_reactor_num > 0 && !m_uring;
+    m_listenfd = -1;
+    if (!sharded)
+        m_listenfd = takeListenfd(m_reuseport);
+    //预留一个备用描述符，描述符耗尽时用于拒绝新连接
+    m_idlefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
 
     //4.epoll创建内核事件表
     epoll_event events[MAX_EVENT_NUMBER];
@@ -155,209 +261,448 @@ void WebServer::eventListen()
     assert(m_epollfd != -1);
 
     //注意：listenfd不能注册EPOLLONESHOT事件，因为需要持续监听/触发而非监听一次
-    utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode);
-    http_conn::m_epollfd = m_epollfd;
-
-    //超时事件处理机制-通过管道通知主线程
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
-    assert(ret != -1);
-    //设置管道写端为非阻塞，因此一旦有信号，就可以立即触发并通知主线程
-    utils.setnonblocking(m_pipefd[1]);
-    //epoll监听管道读端
-    utils.addfd(m_epollfd, m_pipefd[0], false, 0);
+    //epoll_event.data.ptr统一使用指针：连接为http_conn对象，其余描述符为对应成员变量的地址
+    if (m_listenfd != -1)
+        utils.addfd(m_epollfd, m_listenfd, false, m_LISTENTrigmode, &m_listenfd);
+
+    //超时事件处理机制：timerfd周期性到期，epoll直接监听，无需信号处理函数和管道中转
+    m_timerfd = utils.create_tickfd();
+    utils.addfd(m_epollfd, m_timerfd, false, 0, &m_timerfd);
+
+    //SIGTERM（关闭）和SIGUSR2（平滑升级）已在init中屏蔽，通过signalfd同步读取
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR2);
+    m_signalfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(m_signalfd != -1);
+    utils.addfd(m_epollfd, m_signalfd, false, 0, &m_signalfd);
+
+    //Reactor模式下监听工作线程的完成通知
+    utils.addfd(m_epollfd, m_cq.get_fd(), false, 0, &m_cq);
 
     utils.addsig(SIGPIPE, SIG_IGN);
-    utils.addsig(SIGALRM, utils.sig_handler, false);
-    utils.addsig(SIGTERM, utils.sig_handler, false);
-
-    alarm(TIMESLOT);
 
     //工具类,信号和描述符基础操作
-    Utils::u_pipefd = m_pipefd;
     Utils::u_epollfd = m_epollfd;
+
+    //主从Reactor模式：主线程只负责accept和信号，连接的I/O事件由各子Reactor线程处理
+    if (m_reactor_num > 0 && !m_uring)
+    {
+        m_reactors = new sub_reactor[m_reactor_num];
+        for (int i = 0; i < m_reactor_num; ++i)
+        {
+            int listenfd = sharded ? takeListenfd(true) : -1;
+            m_reactors[i].init(this, i, m_close_log, listenfd);
+            m_reactors[i].start();
+        }
+    }
+
+    //每个事件循环只管理自己的空闲长连接，总上限按事件循环数平分
+    int loops = m_reactors ? m_reactor_num : 1;
+    m_loop_idle = 0;
+    if (m_max_idle > 0)
+        m_loop_idle = m_max_idle / loops > 0 ? m_max_idle / loops : 1;
+
+    //分片数量减少时多出的继承socket直接关闭，其监听队列中的连接由客户端重试
+    for (size_t i = 0; i < m_inherited.size(); ++i)
+        close(m_inherited[i]);
+    m_inherited.clear();
+    //通知旧进程停止accept
+    listen_handoff::ready();
+}
+
+//取一个继承的监听socket，没有则新建
+int WebServer::takeListenfd(bool reuseport)
+{
+    if (m_inherited.empty())
+        return openListenfd(reuseport);
+    int listenfd = m_inherited.front();
+    m_inherited.erase(m_inherited.begin());
+    return listenfd;
 }
 
-void WebServer::timer(int connfd, struct sockaddr_in client_address)
+//epollfd、timer_lst和cq为连接所属Reactor的内核事件表、定时器链表和完成队列，须在该Reactor的线程中调用
+void WebServer::timer(int connfd, struct sockaddr_in client_address, int epollfd, sort_timer_lst *timer_lst,
+                      completion_queue<http_conn> *cq)
 {
-    users[connfd].init(connfd, client_address, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_databaseName);
+    utils.set_busy_poll(connfd);
+
+    //连接数接近上限：新连接优先，淘汰本事件循环中空闲最久的长连接
+    if (http_conn::m_user_count >= http_conn::m_busy_conns)
+        timer_lst->evict_idle();
+
+    //从连接注册表分配连接对象
+    http_conn *conn = conn_registry::get_instance()->acquire(connfd);
+    conn->m_cq = cq;
+    conn->init(connfd, client_address, epollfd, m_root, m_CONNTrigmode, m_close_log, m_user, m_passWord, m_databaseName);
 
     //初始化client_data数据
     //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-    users_timer[connfd].address = client_address;
-    users_timer[connfd].sockfd = connfd;
+    client_data *user_data = &conn->m_timer_data;
+    user_data->address = client_address;
+    user_data->sockfd = connfd;
+    user_data->epollfd = epollfd;
+    user_data->timer_lst = timer_lst;
+    user_data->conn = conn;
+    user_data->tasks = 0;
+    user_data->closing = false;
     util_timer *timer = new util_timer;
-    timer->user_data = &users_timer[connfd];
+    timer->user_data = user_data;
     timer->cb_func = cb_func;
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
-    users_timer[connfd].timer = timer;
-    utils.m_timer_lst.add_timer(timer);
+    //新连接的截止时间（接收第一个请求头部）已在conn->init中设置
+    timer->expire = user_data->deadline.load(std::memory_order_relaxed);
+    user_data->timer = timer;
+    timer_lst->add_timer(timer);
+}
+
+//owner非空表示由子Reactor自己accept的连接（SO_REUSEPORT分片），直接注册到该子Reactor
+//否则单Reactor由主线程直接管理新连接，主从Reactor则轮询分发给子Reactor
+void WebServer::newconn(int connfd, struct sockaddr_in client_address, sub_reactor *owner)
+{
+    if (owner)
+    {
+        timer(connfd, client_address, owner->m_epollfd, &owner->m_timer_lst, &owner->m_cq);
+    }
+    else if (m_reactor_num > 0)
+    {
+        m_reactors[m_next_reactor].dispatch(connfd, client_address);
+        m_next_reactor = (m_next_reactor + 1) % m_reactor_num;
+    }
+    else
+    {
+        timer(connfd, client_address, m_epollfd, &utils.m_timer_lst, &m_cq);
+    }
 }
 
-//若有数据传输，则将定时器往后延迟3个单位
+//若有数据传输，则将定时器设置为连接当前阶段的截止时间
+//截止时间只在阶段切换或发送达到最低速率时推迟，零散的数据不会无限延长连接
 //并对新的定时器在链表上的位置进行调整
-void WebServer::adjust_timer(util_timer *timer)
+//idle由调用方给出：连接的阶段可能正被工作线程修改，这里不读取连接对象
+void WebServer::adjust_timer(util_timer *timer, bool idle)
 {
-    time_t cur = time(NULL);
-    timer->expire = cur + 3 * TIMESLOT;
-    utils.m_timer_lst.adjust_timer(timer);
+    sort_timer_lst *timer_lst = timer->user_data->timer_lst;
+    timer->expire = timer->user_data->deadline.load(std::memory_order_relaxed);
+    timer_lst->adjust_timer(timer);
+
+    //响应发送完毕进入空闲的长连接加入LRU链表，超过空闲连接数上限时淘汰空闲最久的
+    timer_lst->set_idle(timer, idle);
+    if (idle && m_loop_idle > 0 && timer_lst->idle_count() > m_loop_idle)
+        timer_lst->evict_idle();
 
     LOG_INFO("%s", "adjust timer once");
 }
 
-void WebServer::deal_timer(util_timer *timer, int sockfd)
+void WebServer::deal_timer(util_timer *timer)
 {
-    //关闭当前超时连接
-    timer->cb_func(&users_timer[sockfd]);
-    if (timer)
-    {
-        //从定时器容器中删除该定时器
-        utils.m_timer_lst.del_timer(timer);
-    }
-
-    LOG_INFO("close fd %d", users_timer[sockfd].sockfd);
+    //连接已经关闭（如工作线程汇报的读写失败与对端关闭事件先后到达）
+    if (!timer)
+        return;
+    client_data *user_data = timer->user_data;
+    void (*cb)(client_data *) = timer->cb_func;
+    int sockfd = user_data->sockfd;
+    //先从连接所属Reactor的定时器容器中删除该定时器
+    user_data->timer_lst->del_timer(timer);
+    //再关闭连接，回调函数会归还连接对象，之后不能再访问user_data
+    cb(user_data);
+
+    LOG_INFO("close fd %d", sockfd);
 }
 
-bool WebServer::dealclientdata()
+//listenfd为就绪的监听socket，owner为执行accept的子Reactor（主线程为NULL）
+//LT和ET模式统一批量accept，每次唤醒最多接受ACCEPT_BATCH个连接，避免连接风暴时已有连接的读写被饿死
+bool WebServer::dealclientdata(int listenfd, sub_reactor *owner)
 {
     struct sockaddr_in client_address;  //客户端的ip和port
-    socklen_t client_addrlength = sizeof(client_address);
-    //LT模式
-    if (0 == m_LISTENTrigmode)
+    socklen_t client_addrlength;
+    //每个执行accept的线程使用自己的备用描述符和内核事件表
+    int &idlefd = owner ? owner->m_idlefd : m_idlefd;
+    int epollfd = owner ? owner->m_epollfd : m_epollfd;
+    int *tag = owner ? &owner->m_listenfd : &m_listenfd;
+
+    for (int i = 0; i < ACCEPT_BATCH; ++i)
     {
-        //系统调用accept从listen监听队列中接受一个连接
-        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
+        client_addrlength = sizeof(client_address);
+        //accept4在接受连接的同时设置非阻塞和close-on-exec，省去后续的fcntl
+        int connfd = accept4(listenfd, (struct sockaddr *)&client_address, &client_addrlength,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
         if (connfd < 0)
         {
+            //监听队列已空，不是错误
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            //被信号中断，或连接在accept之前已被对端重置
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            //描述符耗尽：连接会一直留在监听队列中，LT模式下监听socket持续就绪导致事件循环空转
+            //借用备用描述符接受并立即关闭该连接
+            if ((errno == EMFILE || errno == ENFILE) && idlefd != -1)
+            {
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+                dropconn(listenfd, idlefd);
+                continue;
+            }
             LOG_ERROR("%s:errno is:%d", "accept error", errno);
             return false;
         }
-        if (http_conn::m_user_count >= MAX_FD)
+        //连接注册表等按描述符索引的表只有MAX_FD项，缓存文件和上传临时文件也占用描述符，连接的描述符可能超出
+        if (connfd >= MAX_FD)
+        {
+            utils.show_error(connfd, "Internal server busy");
+            LOG_ERROR("fd %d exceeds MAX_FD", connfd);
+            continue;
+        }
+        //连接数已达上限：本事件循环管理的连接中有空闲的长连接时接受新连接，由timer淘汰空闲最久的一个
+        //主从Reactor模式下主线程不管理连接，无法淘汰，只能拒绝
+        sort_timer_lst *timer_lst = owner ? &owner->m_timer_lst : (m_reactors ? NULL : &utils.m_timer_lst);
+        if (http_conn::m_user_count >= m_max_conn && !(timer_lst && timer_lst->idle_count() > 0))
         {
             utils.show_error(connfd, "Internal server busy");
             LOG_ERROR("%s", "Internal server busy");
-            return false;
+            continue;
         }
         //接受新连接后立即初始化定时器
-        timer(connfd, client_address);
+        newconn(connfd, client_address, owner);
     }
-    //ET模式
-    else
+
+    //达到单次上限：LT模式下监听socket会在下一轮再次就绪
+    //ET模式下需要重新激活，否则监听队列中剩余的连接不会再触发事件
+    if (1 == m_LISTENTrigmode)
+    {
+        epoll_event event;
+        event.data.ptr = tag;
+        event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+        epoll_ctl(epollfd, EPOLL_CTL_MOD, listenfd, &event);
+    }
+    return true;
+}
+
+//描述符耗尽时释放备用描述符，接受并关闭一个连接，再重新占用备用描述符
+//对端会立即收到连接关闭，而不是在监听队列中等待超时
+void WebServer::dropconn(int listenfd, int &idlefd)
+{
+    close(idlefd);
+    int connfd = accept(listenfd, NULL, NULL);
+    if (connfd >= 0)
+        close(connfd);
+    idlefd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+bool WebServer::dealwithsignal(bool &stop_server)
+{
+    struct signalfd_siginfo info;
+    //signalfd为非阻塞，读出当前所有待处理的信号
+    while (1)
     {
-        while (1)
+        ssize_t ret = read(m_signalfd, &info, sizeof(info));
+        if (ret != sizeof(info))
         {
-            int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlength);
-            if (connfd < 0)
-            {
-                LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                break;
-            }
-            if (http_conn::m_user_count >= MAX_FD)
-            {
-                utils.show_error(connfd, "Internal server busy");
-                LOG_ERROR("%s", "Internal server busy");
-                break;
-            }
-            timer(connfd, client_address);
+            return errno == EAGAIN;
+        }
+        if (info.ssi_signo == SIGTERM)
+        {
+            stop_server = true;
+        }
+        else if (info.ssi_signo == SIGUSR2)
+        {
+            startupgrade();
         }
-        return false;
     }
-    return true;
 }
 
-bool WebServer::dealwithsignal(bool &timeout, bool &stop_server)
+//SIGUSR2：启动新版本进程并把监听socket交给它，新进程就绪前本进程照常accept
+void WebServer::startupgrade()
 {
-    int ret = 0;
-    int sig;
-    char signals[1024];
-    //recv读取sockfd m_pipefd[0]上的数据，signals是buf
-    //返回值ret为实际读取的数据长度
-    ret = recv(m_pipefd[0], signals, sizeof(signals), 0);
-    if (ret == -1)
+    if (m_upgradefd != -1 || m_draining)
     {
-        return false;
+        LOG_INFO("%s", "upgrade already in progress");
+        return;
     }
-    else if (ret == 0)
+
+    std::vector<int> fds;
+    if (m_listenfd != -1)
+        fds.push_back(m_listenfd);
+    for (int i = 0; m_reactors && i < m_reactor_num; ++i)
     {
-        return false;
+        if (m_reactors[i].m_listenfd != -1)
+            fds.push_back(m_reactors[i].m_listenfd);
+    }
+    if (fds.empty())
+        return;
+
+    m_upgradefd = listen_handoff::spawn(&fds[0], fds.size(), m_upgrade_pid);
+    if (m_upgradefd == -1)
+    {
+        LOG_ERROR("%s:errno is:%d", "upgrade spawn failure", errno);
+        return;
+    }
+    LOG_INFO("upgrade: new process %d started", (int)m_upgrade_pid);
+
+    if (m_uring)
+        m_uring->watch_upgrade();
+    else
+        utils.addfd(m_epollfd, m_upgradefd, false, 0, &m_upgradefd);
+}
+
+//读取新进程的就绪通知：就绪则停止accept并开始排空连接，新进程退出则放弃本次升级
+//返回false表示交接socket已关闭
+bool WebServer::dealwithupgrade()
+{
+    char ok;
+    ssize_t ret = read(m_upgradefd, &ok, 1);
+    if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+        return true;
+
+    if (!m_uring)
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_upgradefd, 0);
+    close(m_upgradefd);
+    m_upgradefd = -1;
+
+    if (ret == 1)
+    {
+        LOG_INFO("upgrade: process %d took over, draining %d connections", (int)m_upgrade_pid, (int)http_conn::m_user_count);
+        stopaccept();
+        m_draining = true;
+        http_conn::m_draining = true;
+        m_drain_deadline = time_ms() + DRAIN_TIMEOUT * 1000;
     }
     else
     {
-        for (int i = 0; i < ret; ++i)
+        LOG_ERROR("upgrade: process %d failed to start", (int)m_upgrade_pid);
+        waitpid(m_upgrade_pid, NULL, WNOHANG);
+    }
+    return false;
+}
+
+//新进程已接管监听socket，本进程关闭自己持有的副本，监听队列保留在新进程中
+void WebServer::stopaccept()
+{
+    if (m_uring)
+    {
+        m_uring->stop_accept();
+    }
+    else if (m_listenfd != -1)
+    {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+    }
+    if (m_listenfd != -1)
+    {
+        close(m_listenfd);
+        m_listenfd = -1;
+    }
+    for (int i = 0; m_reactors && i < m_reactor_num; ++i)
+        m_reactors[i].stop_accept();
+}
+
+//排空阶段：连接全部关闭或超时后退出
+bool WebServer::drained()
+{
+    return m_draining && (http_conn::m_user_count == 0 || time_ms() >= m_drain_deadline);
+}
+
+//timerfd到期，读出到期次数后标记需要处理定时器链表
+bool WebServer::dealwithtimer(bool &timeout)
+{
+    uint64_t expirations;
+    if (read(m_timerfd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return false;
+    }
+    timeout = true;
+    return true;
+}
+
+//Reactor模式：处理工作线程通过完成队列汇报的结果，读写失败的连接在这里关闭
+//只关闭序号一致的连接，避免连接已因其它事件关闭、描述符被新连接复用后误关新连接
+void WebServer::dealwithcompletion(completion_queue<http_conn> *cq)
+{
+    std::vector<completion_queue<http_conn>::completion> done;
+    cq->drain(done);
+    for (size_t i = 0; i < done.size(); ++i)
+    {
+        http_conn *request = done[i].request;
+        if (request->get_serial() != done[i].serial)
+            continue;
+        //连接已在工作线程处理期间关闭，最后一个任务完成后归还
+        if (0 == --request->m_timer_data.tasks && request->m_timer_data.closing)
         {
-            switch (signals[i])
-            {
-                case SIGALRM:
-                {
-                    timeout = true;
-                    break;
-                }
-                case SIGTERM:
-                {
-                    stop_server = true;
-                    break;
-                }
-            }
+            release_conn(&request->m_timer_data);
+            continue;
         }
+        if (!request->m_timer_data.timer)
+            continue;
+        if (done[i].close)
+            deal_timer(request->m_timer_data.timer);
+        //工作线程可能切换了连接阶段（如发送完毕进入空闲），截止时间可能提前，重新设置定时器
+        //工作线程重新注册事件后，连接可能已再次分发给其它工作线程，此时完成消息中的空闲状态已过期
+        else
+            adjust_timer(request->m_timer_data.timer, done[i].idle && 0 == request->m_timer_data.tasks);
     }
-    return true;
 }
 
-void WebServer::dealwithread(int sockfd)
+void WebServer::dealwithread(http_conn *conn)
 {
-    util_timer *timer = users_timer[sockfd].timer;
+    util_timer *timer = conn->m_timer_data.timer;
 
     //reactor
     if (1 == m_actormodel)
     {
+        //有新数据到达的长连接不再空闲，在交给工作线程之前切换阶段，避免被当作空闲连接淘汰
+        conn->wake();
         if (timer)
         {
             adjust_timer(timer);
         }
 
         //将读事件放入请求队列，由工作线程从中取出并“读取数据”
-        m_pool->append(users + sockfd, 0);
-
-        while (true)
+        //工作线程完成后通过完成队列异步通知，事件循环不再等待，继续处理其它连接
+        //请求队列已满时无法处理，直接关闭连接
+        if (!m_pool->append(conn, 0))
         {
-            if (1 == users[sockfd].improv)
-            {
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
+            LOG_ERROR("%s", "request queue full");
+            deal_timer(timer);
+        }
+        else
+        {
+            ++conn->m_timer_data.tasks;
         }
     }
     //proactor
     else
     {
         //proactor模式：仍然由主线程负责客户连接的数据读取
-        if (users[sockfd].read_once())
+        if (conn->read_once())
         {
-            LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
-
-            //将读事件放入请求队列，由工作线程进行互斥锁竞争，并进行相应的业务处理（thread_pool.h中的worker函数）
-            m_pool->append_p(users + sockfd);
+            LOG_INFO("deal with the client(%s)", inet_ntoa(conn->get_address()->sin_addr));
 
+            //交给工作线程之前调整定时器，之后连接的阶段由工作线程修改
             if (timer)
             {
                 adjust_timer(timer);
             }
+
+            //将读事件放入请求队列，由工作线程进行互斥锁竞争，并进行相应的业务处理（thread_pool.h中的worker函数）
+            //请求队列已满时无法处理，直接关闭连接
+            if (!m_pool->append_p(conn))
+            {
+                LOG_ERROR("%s", "request queue full");
+                deal_timer(timer);
+            }
+            else
+            {
+                ++conn->m_timer_data.tasks;
+            }
         }
         else
         {
-            deal_timer(timer, sockfd);
+            deal_timer(timer);
         }
     }
 }
 
-void WebServer::dealwithwrite(int sockfd)
+void WebServer::dealwithwrite(http_conn *conn)
 {
-    util_timer *timer = users_timer[sockfd].timer;
+    util_timer *timer = conn->m_timer_data.timer;
     //reactor
     if (1 == m_actormodel)
     {
@@ -366,102 +711,142 @@ void WebServer::dealwithwrite(int sockfd)
             adjust_timer(timer);
         }
 
-        m_pool->append(users + sockfd, 1);
-
-        while (true)
+        //工作线程完成后通过完成队列异步通知，事件循环不再等待，继续处理其它连接
+        //请求队列已满时无法处理，直接关闭连接
+        if (!m_pool->append(conn, 1))
         {
-            if (1 == users[sockfd].improv)
-            {
-                if (1 == users[sockfd].timer_flag)
-                {
-                    deal_timer(timer, sockfd);
-                    users[sockfd].timer_flag = 0;
-                }
-                users[sockfd].improv = 0;
-                break;
-            }
+            LOG_ERROR("%s", "request queue full");
+            deal_timer(timer);
+        }
+        else
+        {
+            ++conn->m_timer_data.tasks;
         }
     }
     //proactor
     else
     {
-        if (users[sockfd].write())
+        http_conn::WRITE_END end;
+        if (conn->write(&end))
         {
-            LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
+            LOG_INFO("send data to the client(%s)", inet_ntoa(conn->get_address()->sin_addr));
 
             if (timer)
             {
-                adjust_timer(timer);
+                adjust_timer(timer, http_conn::WRITE_IDLE == end);
+            }
+
+            //读缓冲区中还有流水线请求，交给工作线程继续处理
+            if (http_conn::WRITE_PIPELINE == end)
+            {
+                if (!m_pool->append_p(conn))
+                {
+                    LOG_ERROR("%s", "request queue full");
+                    deal_timer(timer);
+                }
+                else
+                {
+                    ++conn->m_timer_data.tasks;
+                }
             }
         }
         else
         {
-            deal_timer(timer, sockfd);
+            deal_timer(timer);
         }
     }
 }
 
 void WebServer::eventLoop()
 {
+    //io_uring后端
+    if (m_uring)
+    {
+        m_uring->run();
+        return;
+    }
+
     bool timeout = false;
     bool stop_server = false;
 
     while (!stop_server)
     {
         //events是epoll_wait检测到的就绪事件
-        int number = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+        int number = utils.wait_events(m_epollfd, events, MAX_EVENT_NUMBER);
         if (number < 0 && errno != EINTR)
         {
             LOG_ERROR("%s", "epoll failure");
             break;
         }
+        //处理本轮事件之前刷新Date头部缓存，工作线程生成响应时直接使用
+        date_cache::get_instance()->update();
 
         for (int i = 0; i < number; i++)
         {
-            int sockfd = events[i].data.fd;
+            void *ptr = events[i].data.ptr;
 
             //处理新到的客户连接（若就绪事件的sockfd刚好是监听的fd，说明就是刚的到的用户连接
-            if (sockfd == m_listenfd)
+            if (ptr == &m_listenfd)
             {
-                bool flag = dealclientdata();
+                bool flag = dealclientdata(m_listenfd);
                 if (false == flag)
                     continue;
             }
-            //处理：对端半关闭连接(CLOSE_WAIT)、连接断开、错误等事件
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            //处理定时器到期
+            else if ((ptr == &m_timerfd) && (events[i].events & EPOLLIN))
             {
-                //deal_timer()关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[sockfd].timer;
-                deal_timer(timer, sockfd);
+                bool flag = dealwithtimer(timeout);
+                if (false == flag)
+                    LOG_ERROR("%s", "dealwithtimer failure");
             }
-            //处理信号（超时或连接关闭信号）
-            else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN))
+            //处理关闭服务器的信号
+            else if ((ptr == &m_signalfd) && (events[i].events & EPOLLIN))
             {
-                bool flag = dealwithsignal(timeout, stop_server);
+                bool flag = dealwithsignal(stop_server);
                 if (false == flag)
-                    LOG_ERROR("%s", "dealclientdata failure");
+                    LOG_ERROR("%s", "dealwithsignal failure");
+            }
+            //处理工作线程汇报的读写完成结果
+            else if (ptr == &m_cq)
+            {
+                dealwithcompletion(&m_cq);
+            }
+            //平滑升级：新进程就绪或启动失败
+            else if (ptr == &m_upgradefd)
+            {
+                dealwithupgrade();
+            }
+            //处理：对端半关闭连接(CLOSE_WAIT)、连接断开、错误等事件
+            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                //deal_timer()关闭连接，移除对应的定时器
+                http_conn *conn = (http_conn *)ptr;
+                deal_timer(conn->m_timer_data.timer);
             }
             //处理读事件，处理客户连接上接收到的数据
             else if (events[i].events & EPOLLIN)
             {
-                dealwithread(sockfd);
+                dealwithread((http_conn *)ptr);
             }
             //处理写事件
             else if (events[i].events & EPOLLOUT)
             {
-                dealwithwrite(sockfd);
+                dealwithwrite((http_conn *)ptr);
             }
         }
         //超时无连接，写入日志
         if (timeout)
         {
-			//调用信号处理函数，将信号值从管道写端u_pipefd[1]写入
-			//下一次循环epoll_wait将检测到该超时事件并处理
+            //定时器事件优先级低于I/O事件，在本轮I/O事件处理完之后再处理定时器链表
             utils.timer_handler();
 
-            LOG_INFO("%s", "timer tick");
+            LOG_INFO("timer tick, response cache hit:%lu miss:%lu, requests:%llu heap allocs:%llu", file_cache::get_instance()->hits(), file_cache::get_instance()->misses(), alloc_counter::requests(), alloc_counter::allocs());
 
             timeout = false;
+
+            //平滑升级：已有连接全部关闭后退出
+            if (drained())
+                stop_server = true;
         }
     }
 }
@@ -11,13 +11,23 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <vector>
 
 #include "./threadpool/threadpool.h"
 #include "./http/http_conn.h"
+#include "./http/conn_registry.h"
+#include "./reactor/sub_reactor.h"
+#include "./reactor/uring_proactor.h"
+#include "./upgrade/listen_handoff.h"
 
 const int MAX_FD = 65536;           //最大文件描述符
 const int MAX_EVENT_NUMBER = 10000; //最大事件数
-const int TIMESLOT = 5;             //最小超时单位
+const int ACCEPT_BATCH = 64;        //每次监听socket就绪时最多accept的连接数
+const int FD_RESERVE = 64;          //为监听套接字、日志、数据库连接等预留的文件描述符数
+const int BUSY_PERCENT = 75;        //连接数达到上限的该百分比后不再保持长连接，新连接淘汰空闲最久的长连接
+const int DRAIN_TIMEOUT = 30;       //平滑升级时旧进程等待已有连接关闭的最长时间（秒）
 
 class WebServer
 {
@@ -27,21 +37,36 @@ public:
 
     void init(int port , string user, string passWord, string databaseName,
               int log_write , int opt_linger, int trigmode, int sql_num,
-              int thread_num, int close_log, int actor_model);
+              int thread_num, int close_log, int actor_model, int reactor_num,
+              int reuseport, int backlog, int io_backend, int tick_ms, int busy_poll,
+              string cache_control, int max_body, int write_quota,
+              int header_timeout, int body_timeout, int idle_timeout, int min_send_rate,
+              int max_requests, int max_idle);
 
     void thread_pool();
     void sql_pool();
     void log_write();
     void trig_mode();
     void eventListen();
+    int openListenfd(bool reuseport);
+    int takeListenfd(bool reuseport);
     void eventLoop();
-    void timer(int connfd, struct sockaddr_in client_address);
-    void adjust_timer(util_timer *timer);
-    void deal_timer(util_timer *timer, int sockfd);
-    bool dealclientdata();
-    bool dealwithsignal(bool& timeout, bool& stop_server);
-    void dealwithread(int sockfd);
-    void dealwithwrite(int sockfd);
+    void timer(int connfd, struct sockaddr_in client_address, int epollfd, sort_timer_lst *timer_lst,
+               completion_queue<http_conn> *cq);
+    void newconn(int connfd, struct sockaddr_in client_address, sub_reactor *owner);
+    void adjust_timer(util_timer *timer, bool idle = false);
+    void deal_timer(util_timer *timer);
+    bool dealclientdata(int listenfd, sub_reactor *owner = NULL);
+    void dropconn(int listenfd, int &idlefd);
+    bool dealwithsignal(bool& stop_server);
+    bool dealwithtimer(bool& timeout);
+    void startupgrade();
+    bool dealwithupgrade();
+    void stopaccept();
+    bool drained();
+    void dealwithcompletion(completion_queue<http_conn> *cq);
+    void dealwithread(http_conn *conn);
+    void dealwithwrite(http_conn *conn);
 
 public:
     //基础
@@ -50,10 +75,17 @@ public:
     int m_log_write;
     int m_close_log;
     int m_actormodel;
+    int m_reactor_num;      //子Reactor数量，0表示单Reactor
+    int m_io_backend;       //I/O后端，0-epoll，1-io_uring
 
-    int m_pipefd[2];
+    int m_timerfd;          //定时器链表的检查周期由timerfd驱动
+    int m_signalfd;         //SIGTERM通过signalfd同步读取
+    int m_tick_ms;          //定时器链表的检查周期（毫秒）
+    int m_busy_poll;        //忙轮询时长（微秒），0表示事件循环直接阻塞等待
+    int m_max_conn;         //连接数上限，受MAX_FD和文件描述符上限约束
+    int m_max_idle;         //空闲长连接总数上限，0表示不限制
+    int m_loop_idle;        //每个事件循环的空闲长连接数上限，按事件循环数平分m_max_idle
     int m_epollfd;
-    http_conn *users;
 
     //数据库相关
     connection_pool *m_connPool;
@@ -65,18 +97,35 @@ public:
     //线程池相关
     threadpool<http_conn> *m_pool;
     int m_thread_num;
+    completion_queue<http_conn> m_cq;   //Reactor模式下工作线程向主线程汇报完成的队列
 
     //epoll_event相关
     epoll_event events[MAX_EVENT_NUMBER];
 
-    int m_listenfd;
+    int m_listenfd;         //主线程的监听socket，SO_REUSEPORT分片模式下为-1
+    int m_reuseport;        //是否为每个子Reactor开启独立的SO_REUSEPORT监听socket
+    int m_backlog;          //监听队列长度
+    int m_idlefd;           //备用描述符，描述符耗尽时释放出来接受并关闭新连接
     int m_OPT_LINGER;
     int m_TRIGMode;
     int m_LISTENTrigmode;
     int m_CONNTrigmode;
 
     //定时器相关
-    client_data *users_timer;
     Utils utils;
+
+    //主从Reactor相关
+    sub_reactor *m_reactors;
+    int m_next_reactor;     //轮询分发新连接的下标
+
+    //io_uring后端，未启用或内核不支持时为NULL
+    uring_proactor *m_uring;
+
+    //平滑升级相关
+    std::vector<int> m_inherited;   //新进程从旧进程继承、尚未使用的监听socket
+    int m_upgradefd;                //旧进程与新进程的交接socket，未在升级时为-1
+    pid_t m_upgrade_pid;            //新进程pid
+    bool m_draining;                //新进程已接管监听socket，旧进程正在等待已有连接关闭
+    long long m_drain_deadline;     //排空连接的截止时间（毫秒）
 };
 #endif